@@ -2,7 +2,7 @@
 set -euo pipefail
 
 # Simple run wrapper for Magnet Monitor
-# Usage: ./run.sh start|stop|status
+# Usage: ./run.sh start|stop|status|reload
 
 ROOT_DIR="$(cd "$(dirname "$0")" && pwd)"
 BIN="$ROOT_DIR/build/magnet_monitor"
@@ -43,6 +43,16 @@ stop() {
   kill "$PID" && rm -f "$PIDFILE"
 }
 
+reload() {
+  if [ ! -f "$PIDFILE" ] || ! kill -0 "$(cat "$PIDFILE")" 2>/dev/null; then
+    echo "magnet_monitor not running"
+    exit 1
+  fi
+  # SIGHUP makes the service re-read config.json without restarting
+  kill -HUP "$(cat "$PIDFILE")"
+  echo "Reload requested (PID $(cat "$PIDFILE"))"
+}
+
 status() {
   if [ -f "$PIDFILE" ] && kill -0 "$(cat "$PIDFILE")" 2>/dev/null; then
     echo "magnet_monitor running (PID $(cat "$PIDFILE"))"
@@ -55,5 +65,6 @@ case ${1-} in
   start) start ;; 
   stop) stop ;; 
   status) status ;; 
-  *) echo "Usage: $0 start|stop|status"; exit 2 ;;
+  reload) reload ;;
+  *) echo "Usage: $0 start|stop|status|reload"; exit 2 ;;
 esac
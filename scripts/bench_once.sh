@@ -0,0 +1,46 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Benchmark the --once path: time to first publish after a cold start.
+# Runs the binary N times from the directory holding config.json and reports the
+# "Time to first publish" it prints plus the wall time of each run.
+# Usage:
+#   ./scripts/bench_once.sh [runs] [binary]
+# Example (on the router, from the directory with config.json):
+#   ./scripts/bench_once.sh 10 ./build/magnet_monitor
+
+RUNS=${1:-10}
+BIN=${2:-./build/magnet_monitor}
+
+if [ ! -x "$BIN" ]; then
+  echo "Executable not found: $BIN"
+  exit 1
+fi
+
+results=""
+failed=0
+for i in $(seq 1 "$RUNS"); do
+  start_ns=$(date +%s%N)
+  if out=$("$BIN" --once 2>&1); then
+    wall_ms=$(( ($(date +%s%N) - start_ns) / 1000000 ))
+    first_ms=$(echo "$out" | sed -n 's/^Time to first publish: \([0-9]*\) ms.*/\1/p')
+    ready_ms=$(echo "$out" | sed -n 's/.*(file ready after \([0-9]*\) ms).*/\1/p')
+    echo "run $i: first publish ${first_ms:-?} ms, file ready ${ready_ms:-?} ms, wall ${wall_ms} ms"
+    [ -n "$first_ms" ] && results="$results $first_ms"
+  else
+    echo "run $i: failed"
+    failed=$((failed + 1))
+  fi
+done
+
+if [ -z "$results" ]; then
+  echo "No successful runs"
+  exit 1
+fi
+
+echo "$results" | tr ' ' '\n' | sed '/^$/d' | sort -n | awk -v failed="$failed" '
+  { v[NR] = $1; sum += $1 }
+  END {
+    printf "time to first publish over %d runs (%d failed): min %d ms, median %d ms, max %d ms, mean %.1f ms\n",
+           NR, failed, v[1], v[int((NR + 1) / 2)], v[NR], sum / NR
+  }'
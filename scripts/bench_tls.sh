@@ -0,0 +1,68 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Benchmark TLS session resumption on the FTPS and MQTTS links against local stand-ins.
+# Creates a throwaway CA and server certificate, starts scripts/tls_standin.py (FTPS controller
+# and MQTTS broker on localhost) and runs `magnet_monitor --tls-bench N`, which connects N times
+# per link with TLS_SESSION_CACHE off and then on and prints handshake time and CPU per connection.
+# Needs openssl and python3. The MQTT link is measured only in builds with ENABLE_MQTT.
+# Usage:
+#   ./scripts/bench_tls.sh [connections] [binary]
+# Example:
+#   ./scripts/bench_tls.sh 20 ./build/magnet_monitor
+
+RUNS=${1:-20}
+BIN=$(realpath "${2:-./build/magnet_monitor}")
+SCRIPT_DIR=$(cd "$(dirname "$0")" && pwd)
+FTP_PORT=${FTP_PORT:-2990}
+MQTT_PORT=${MQTT_PORT:-8883}
+
+if [ ! -x "$BIN" ]; then
+  echo "Executable not found: $BIN"
+  exit 1
+fi
+
+WORK=$(mktemp -d)
+STANDIN_PID=
+cleanup() {
+  [ -n "$STANDIN_PID" ] && kill "$STANDIN_PID" 2>/dev/null || true
+  rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+# CA and a server certificate for 127.0.0.1 (RSA 2048, as a typical broker would use)
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj "/CN=bench CA" \
+  -keyout "$WORK/ca.key" -out "$WORK/ca.pem" 2>/dev/null
+openssl req -newkey rsa:2048 -nodes -subj "/CN=127.0.0.1" \
+  -keyout "$WORK/server.key" -out "$WORK/server.csr" 2>/dev/null
+printf "subjectAltName=IP:127.0.0.1\n" > "$WORK/san.ext"
+openssl x509 -req -in "$WORK/server.csr" -CA "$WORK/ca.pem" -CAkey "$WORK/ca.key" -CAcreateserial \
+  -days 1 -extfile "$WORK/san.ext" -out "$WORK/server.pem" 2>/dev/null
+
+# A controller directory with one day file
+mkdir -p "$WORK/root/CFDisk/mindata"
+printf "%s,1.0,2.0\n" "$(date +%d.%m.%Y\ %H:%M:%S)" > "$WORK/root/CFDisk/mindata/day$(date +%d%m%y).dat"
+
+python3 "$SCRIPT_DIR/tls_standin.py" --cert "$WORK/server.pem" --key "$WORK/server.key" \
+  --root "$WORK/root" --ftp-port "$FTP_PORT" --mqtt-port "$MQTT_PORT" &
+STANDIN_PID=$!
+sleep 1
+
+cat > "$WORK/config.json" <<JSON
+{
+  "FTP_HOST": "127.0.0.1:$FTP_PORT",
+  "FTP_USER": "bench",
+  "FTP_PASS": "bench",
+  "FTP_TLS": "require",
+  "FTP_CA_FILE": "$WORK/ca.pem",
+  "FTP_TCP_NODELAY": true,
+  "LOCAL_FILE": "$WORK/latest.dat",
+  "MQTT_SERVER": "ssl://127.0.0.1:$MQTT_PORT",
+  "MQTT_CA_FILE": "$WORK/ca.pem",
+  "MQTT_CLIENT_ID": "tls_bench",
+  "MQTT_TOPIC": "bench",
+  "LOG_FILE": "$WORK/bench.log"
+}
+JSON
+
+(cd "$WORK" && "$BIN" --tls-bench "$RUNS")
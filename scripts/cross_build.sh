@@ -16,6 +16,10 @@ if [ -z "$TOOLCHAIN_ROOT" ] || [ -z "$TARGET_TRIPLE" ]; then
   exit 2
 fi
 
+# Without MQTT the rows are printed instead (some output sink must be enabled)
+STDOUT_SINK_FLAG=OFF
+if [ "$ENABLE_MQTT_FLAG" != "ON" ]; then STDOUT_SINK_FLAG=ON; fi
+
 BUILD_DIR="build-openwrt-${TARGET_TRIPLE}"
 rm -rf "$BUILD_DIR"
 mkdir -p "$BUILD_DIR"
@@ -25,7 +29,8 @@ cmake .. \
   -DCMAKE_TOOLCHAIN_FILE=../toolchain-openwrt.cmake \
   -DOPENWRT_TOOLCHAIN_ROOT="$TOOLCHAIN_ROOT" \
   -DOPENWRT_TARGET_TRIPLE="$TARGET_TRIPLE" \
-  -DENABLE_MQTT=$ENABLE_MQTT_FLAG
+  -DENABLE_MQTT=$ENABLE_MQTT_FLAG \
+  -DENABLE_STDOUT_SINK=$STDOUT_SINK_FLAG
 
 make -j$(nproc || echo 1)
 
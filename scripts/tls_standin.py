@@ -0,0 +1,186 @@
+#!/usr/bin/env python3
+# Local TLS stand-ins for the controller and the broker, used by bench_tls.sh:
+#   - an FTP server with explicit TLS (AUTH TLS, PROT P) serving a directory read-only
+#   - an MQTT broker over TLS that accepts every connection and acknowledges QoS1 publishes
+# Both resume TLS sessions like a real server would. Not for production use.
+# Usage:
+#   tls_standin.py --cert server.pem --key server.key --root DIR [--ftp-port 2990] [--mqtt-port 8883]
+import argparse
+import os
+import socket
+import socketserver
+import ssl
+import threading
+
+
+def make_context(cert, key):
+    ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    ctx.load_cert_chain(cert, key)
+    return ctx
+
+
+class FtpHandler(socketserver.StreamRequestHandler):
+    def send(self, line):
+        self.wfile.write((line + "\r\n").encode())
+        self.wfile.flush()
+
+    def start_tls(self):
+        self.request = self.server.tls.wrap_socket(self.request, server_side=True)
+        self.rfile = self.request.makefile("rb")
+        self.wfile = self.request.makefile("wb")
+
+    def accept_data(self, listener, out):
+        try:
+            conn, _ = listener.accept()
+            conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            out["conn"] = self.server.tls.wrap_socket(conn, server_side=True) if self.prot else conn
+        except OSError:
+            pass
+
+    def path(self, arg):
+        return os.path.join(self.server.root + self.cwd, arg)
+
+    def handle(self):
+        self.request.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.cwd = "/"
+        self.pasv = None
+        self.prot = False
+        self.send("220 TLS stand-in")
+        while True:
+            line = self.rfile.readline()
+            if not line:
+                return
+            cmd, _, arg = line.decode().strip().partition(" ")
+            cmd = cmd.upper()
+            if cmd == "AUTH":
+                self.send("234 AUTH TLS ok")
+                self.start_tls()
+            elif cmd == "PBSZ":
+                self.send("200 PBSZ=0")
+            elif cmd == "PROT":
+                self.prot = arg.upper() == "P"
+                self.send("200 ok")
+            elif cmd == "USER":
+                self.send("331 password required")
+            elif cmd == "PASS":
+                self.send("230 logged in")
+            elif cmd == "PWD":
+                self.send('257 "%s"' % self.cwd)
+            elif cmd == "TYPE":
+                self.send("200 ok")
+            elif cmd == "CWD":
+                target = arg if arg.startswith("/") else os.path.join(self.cwd, arg)
+                if os.path.isdir(self.server.root + target):
+                    self.cwd = target
+                    self.send("250 ok")
+                else:
+                    self.send("550 no such directory")
+            elif cmd in ("EPSV", "PASV"):
+                self.pasv = socket.socket()
+                self.pasv.bind(("127.0.0.1", 0))
+                self.pasv.listen(1)
+                port = self.pasv.getsockname()[1]
+                # Accept (and handshake) right away, as the client starts TLS before its command
+                self.data = {}
+                self.data_ready = threading.Thread(target=self.accept_data, args=(self.pasv, self.data))
+                self.data_ready.start()
+                if cmd == "EPSV":
+                    self.send("229 Entering Extended Passive Mode (|||%d|)" % port)
+                else:
+                    self.send("227 Entering Passive Mode (127,0,0,1,%d,%d)" % (port >> 8, port & 255))
+            elif cmd == "SIZE":
+                p = self.path(arg)
+                self.send("213 %d" % os.path.getsize(p) if os.path.isfile(p) else "550 no such file")
+            elif cmd in ("NLST", "LIST", "RETR"):
+                self.transfer(cmd, arg)
+            elif cmd == "QUIT":
+                self.send("221 bye")
+                return
+            else:
+                self.send("502 not implemented")
+
+    def transfer(self, cmd, arg):
+        if cmd == "RETR" and not os.path.isfile(self.path(arg)):
+            self.send("550 no such file")
+            return
+        self.data_ready.join()
+        conn = self.data.get("conn")
+        if conn is None:
+            self.send("425 no data connection")
+            return
+        self.send("150 opening data connection")
+        if cmd == "RETR":
+            with open(self.path(arg), "rb") as f:
+                conn.sendall(f.read())
+        else:
+            names = sorted(os.listdir(self.server.root + self.cwd))
+            conn.sendall("".join(n + "\r\n" for n in names).encode())
+        conn.close()
+        self.pasv.close()
+        self.send("226 transfer complete")
+
+
+class MqttHandler(socketserver.BaseRequestHandler):
+    def read_exact(self, n):
+        data = b""
+        while len(data) < n:
+            chunk = self.request.recv(n - len(data))
+            if not chunk:
+                raise EOFError
+            data += chunk
+        return data
+
+    def handle(self):
+        try:
+            self.request.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            self.request = self.server.tls.wrap_socket(self.request, server_side=True)
+            while True:
+                header = self.read_exact(1)[0]
+                length, shift = 0, 0
+                while True:
+                    b = self.read_exact(1)[0]
+                    length |= (b & 0x7F) << shift
+                    shift += 7
+                    if not b & 0x80:
+                        break
+                body = self.read_exact(length) if length else b""
+                kind = header >> 4
+                if kind == 1:                           # CONNECT -> CONNACK accepted
+                    self.request.sendall(b"\x20\x02\x00\x00")
+                elif kind == 3 and (header >> 1) & 3:   # PUBLISH QoS1 -> PUBACK
+                    topic_len = (body[0] << 8) | body[1]
+                    mid = body[2 + topic_len:4 + topic_len]
+                    self.request.sendall(b"\x40\x02" + mid)
+                elif kind == 12:                        # PINGREQ -> PINGRESP
+                    self.request.sendall(b"\xd0\x00")
+                elif kind == 14:                        # DISCONNECT
+                    return
+        except (EOFError, OSError):
+            return
+
+
+class Server(socketserver.ThreadingMixIn, socketserver.TCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description="FTPS and MQTTS stand-ins for bench_tls.sh")
+    parser.add_argument("--cert", required=True)
+    parser.add_argument("--key", required=True)
+    parser.add_argument("--root", required=True)
+    parser.add_argument("--ftp-port", type=int, default=2990)
+    parser.add_argument("--mqtt-port", type=int, default=8883)
+    args = parser.parse_args()
+
+    tls = make_context(args.cert, args.key)
+    ftp = Server(("127.0.0.1", args.ftp_port), FtpHandler)
+    ftp.tls, ftp.root = tls, os.path.abspath(args.root)
+    mqtt = Server(("127.0.0.1", args.mqtt_port), MqttHandler)
+    mqtt.tls = tls
+    threading.Thread(target=mqtt.serve_forever, daemon=True).start()
+    ftp.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,166 @@
+#include "alarm.h"
+#include "scan.h"
+#include "ts_store.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <sstream>
+
+namespace {
+
+std::string trim(const std::string& s) {
+    size_t b = s.find_first_not_of(" \t");
+    if (b == std::string::npos) return "";
+    size_t e = s.find_last_not_of(" \t");
+    return s.substr(b, e - b + 1);
+}
+
+// Timestamp and the first n numeric fields of a row, read in place with the same rules as
+// decode_row(): date and time may be one field or two, non-numeric fields become NaN
+bool decode_in_place(const std::string& row, long long& ts, float* out, int n) {
+    static const ScanSet delimiters(",;\t");
+    const char* data = row.c_str();
+    const size_t len = row.size();
+    for (int i = 0; i < n; ++i) out[i] = std::numeric_limits<float>::quiet_NaN();
+
+    if (!parse_timestamp(data, ts)) return false;
+    size_t pos = scan_for(data, len, delimiters);
+    if (pos == len) return true;
+    const char delim[2] = { data[pos], '\0' };
+    const ScanSet field_end(delim);
+    size_t start = pos + 1;
+
+    // Date and time in separate columns
+    if (std::memchr(data, ':', pos) == nullptr) {
+        size_t end = start + scan_for(data + start, len - start, field_end);
+        int hh = 0, mi = 0, ss = 0;
+        if (std::memchr(data + start, ':', end - start) != nullptr &&
+            std::sscanf(data + start, " %d:%d:%d", &hh, &mi, &ss) >= 2) {
+            if (hh < 0 || hh > 23 || mi < 0 || mi > 59 || ss < 0 || ss > 60) return false;
+            ts += hh * 3600 + mi * 60 + ss;
+            start = end + 1;
+        }
+    }
+
+    for (int i = 0; i < n && start <= len; ++i) {
+        size_t end = start + scan_for(data + start, len - start, field_end);
+        char* parsed = nullptr;
+        double v = std::strtod(data + start, &parsed);
+        while (parsed < data + end && (*parsed == ' ' || *parsed == '\r')) ++parsed;
+        if (parsed != data + start && parsed == data + end) out[i] = static_cast<float>(v);
+        start = end + 1;
+    }
+    return true;
+}
+
+} // namespace
+
+bool parse_alarm_rules(const std::string& spec, std::vector<AlarmRule>& rules, std::string& error_out) {
+    rules.clear();
+    std::stringstream ss(spec);
+    std::string item;
+    while (std::getline(ss, item, ';')) {
+        std::string text = trim(item);
+        if (text.empty()) continue;
+
+        AlarmRule rule;
+        rule.text = text;
+        const char* p = text.c_str();
+        char* end = nullptr;
+        long field = std::strtol(p, &end, 10);
+        if (end == p || field < 0 || field >= AlarmEvaluator::MAX_FIELDS) {
+            error_out = "alarm rule '" + text + "': expected a field number 0-" +
+                        std::to_string(AlarmEvaluator::MAX_FIELDS - 1);
+            return false;
+        }
+        rule.field = static_cast<int>(field);
+        p = end;
+        rule.rate = std::strncmp(p, "/s", 2) == 0;
+        if (rule.rate) p += 2;
+        while (*p == ' ') ++p;
+        if (*p != '>' && *p != '<') {
+            error_out = "alarm rule '" + text + "': expected > or <";
+            return false;
+        }
+        rule.above = *p++ == '>';
+        double threshold = std::strtod(p, &end);
+        while (*end == ' ') ++end;
+        if (end == p || *end != '\0' || !std::isfinite(threshold)) {
+            error_out = "alarm rule '" + text + "': expected a number after the comparison";
+            return false;
+        }
+        rule.threshold = static_cast<float>(threshold);
+        rules.push_back(rule);
+    }
+    if (rules.size() > static_cast<size_t>(AlarmEvaluator::MAX_RULES)) {
+        error_out = "at most " + std::to_string(AlarmEvaluator::MAX_RULES) + " alarm rules";
+        return false;
+    }
+    return true;
+}
+
+// ============================================================================
+// AlarmEvaluator
+// ============================================================================
+
+AlarmEvaluator::AlarmEvaluator()
+    : count(0), fields_needed(0), previous_ts(0), have_previous(false), last_mask(0), last_fresh(false) {}
+
+bool AlarmEvaluator::configure(const std::string& spec, std::string& error_out) {
+    std::vector<AlarmRule> parsed;
+    if (!parse_alarm_rules(spec, parsed, error_out)) return false;
+
+    rules.swap(parsed);
+    count = static_cast<int>(rules.size());
+    fields_needed = 0;
+    for (int i = 0; i < count; ++i) {
+        field[i] = rules[i].field;
+        is_rate[i] = rules[i].rate ? 1 : 0;
+        sign[i] = rules[i].above ? 1.0f : -1.0f;
+        limit[i] = rules[i].threshold * sign[i];
+        observed[i] = std::numeric_limits<float>::quiet_NaN();
+        if (field[i] + 1 > fields_needed) fields_needed = field[i] + 1;
+    }
+    have_previous = false;
+    last_mask = 0;
+    last_fresh = false;
+    return true;
+}
+
+uint32_t AlarmEvaluator::evaluate(const std::string& row) {
+    last_fresh = false;
+    long long ts = 0;
+    if (count == 0 || !decode_in_place(row, ts, values, fields_needed)) return last_mask;
+    if (have_previous && ts == previous_ts) return last_mask;
+
+    // Rate rules need an earlier row; NaN makes every comparison false until there is one
+    float per_second = have_previous && ts > previous_ts ? 1.0f / static_cast<float>(ts - previous_ts)
+                                                         : std::numeric_limits<float>::quiet_NaN();
+    uint32_t mask = 0;
+    for (int i = 0; i < count; ++i) {
+        float v = values[field[i]];
+        const float candidates[2] = { v, (v - previous[field[i]]) * per_second };
+        float x = candidates[is_rate[i]];
+        observed[i] = x;
+        mask |= static_cast<uint32_t>(x * sign[i] > limit[i]) << i;
+    }
+
+    std::memcpy(previous, values, sizeof(float) * static_cast<size_t>(fields_needed));
+    previous_ts = ts;
+    have_previous = true;
+    last_mask = mask;
+    last_fresh = true;
+    return mask;
+}
+
+std::string AlarmEvaluator::describe(uint32_t mask) const {
+    std::ostringstream oss;
+    for (int i = 0; i < count; ++i) {
+        if (!(mask & (1u << i))) continue;
+        if (oss.tellp() > 0) oss << "; ";
+        oss << rules[i].text << " (" << observed[i] << ")";
+    }
+    return oss.str();
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Threshold and rate-of-change rules checked against every parsed row (ALARM_RULES).
+//
+// A rule is FIELD OP VALUE with FIELD the 0-based index of a numeric field after the timestamp
+// (as in --query), OP > or <, and an optional /s after the field for the change per second
+// since the previous row:
+//
+//   "0>1000; 1<2.5; 0/s>0.5"
+//
+// Rows are decoded in place and the rules evaluated without branches or heap allocation, so
+// normal rows pay almost nothing; only a match costs more (building the alarm message).
+
+struct AlarmRule {
+    int field;
+    bool rate;          // change per second instead of the value itself
+    bool above;         // > (true) or < (false)
+    float threshold;
+    std::string text;   // the rule as written, for messages
+};
+
+// Parse an ALARM_RULES string; an empty string gives no rules
+bool parse_alarm_rules(const std::string& spec, std::vector<AlarmRule>& rules, std::string& error_out);
+
+class AlarmEvaluator {
+public:
+    static const int MAX_RULES = 32;
+    static const int MAX_FIELDS = 64;
+
+    AlarmEvaluator();
+
+    // Replace the rules and forget the previous row. Returns false on a syntax error.
+    bool configure(const std::string& spec, std::string& error_out);
+    bool enabled() const { return count > 0; }
+
+    // Bit i is set if rule i matches the row. A row with the same timestamp as the previous
+    // one (or without a timestamp) returns the previous result and leaves fresh() false.
+    uint32_t evaluate(const std::string& row);
+    bool fresh() const { return last_fresh; }
+
+    // "0>1000 (1043.2); 0/s>0.5 (0.81)": the matching rules with the value that tripped them
+    std::string describe(uint32_t mask) const;
+
+private:
+    std::vector<AlarmRule> rules;
+
+    // Structure-of-arrays copy of the rules for the evaluation loop
+    int count;
+    int fields_needed;
+    int field[MAX_RULES];
+    int is_rate[MAX_RULES];
+    float sign[MAX_RULES];          // +1 for >, -1 for <
+    float limit[MAX_RULES];         // threshold * sign
+
+    float values[MAX_FIELDS];
+    float previous[MAX_FIELDS];
+    float observed[MAX_RULES];      // value or rate each rule saw last
+    long long previous_ts;
+    bool have_previous;
+    uint32_t last_mask;
+    bool last_fresh;
+};
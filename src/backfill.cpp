@@ -0,0 +1,341 @@
+#include "backfill.h"
+#include "ftp_downloader.h"
+#include "output_sink.h"
+#include "mqtt_batcher.h"
+#include "parser.h"
+#include "utils.h"
+#include "ts_store.h"
+#include "local_ring.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <memory>
+#include <cstring>
+#include <ctime>
+#include <sys/stat.h>
+
+namespace {
+
+enum class SlotState { Pending, Ready, Failed };
+
+struct FileSlot {
+    std::string remote;
+    std::string local;
+    SlotState state;
+    long long bytes;
+    std::string error;
+};
+
+long long file_size(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return 0;
+    return static_cast<long long>(st.st_size);
+}
+
+std::string format_rate(double value, const char* unit) {
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(1) << value << " " << unit;
+    return oss.str();
+}
+
+// Steady clock in whole seconds, at least 1 so 0 can mean "not set"
+int steady_seconds() {
+    long long s = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    return static_cast<int>(std::max(1LL, s));
+}
+
+// YYYYMMDD key `days` calendar days after date (before it if negative)
+int add_days(int date, int days) {
+    struct tm tm;
+    std::memset(&tm, 0, sizeof(tm));
+    tm.tm_year = date / 10000 - 1900;
+    tm.tm_mon = date / 100 % 100 - 1;
+    tm.tm_mday = date % 100 + days;
+    tm.tm_hour = 12;
+    time_t t = timegm(&tm);     // normalises the day past month and year ends
+    struct tm out;
+    if (!gmtime_r(&t, &out)) return date;
+    return (out.tm_year + 1900) * 10000 + (out.tm_mon + 1) * 100 + out.tm_mday;
+}
+
+} // namespace
+
+Backfiller::Backfiller() : store(nullptr), ring(nullptr), active(false), background(false), stop_requested(false), failed_at(0) {}
+
+Backfiller::~Backfiller() {
+    stop();
+}
+
+void Backfiller::stop() {
+    stop_requested = true;
+    if (worker.joinable()) worker.join();
+    stop_requested = false;
+}
+
+bool Backfiller::start(const Config& cfg, int from_date, int to_date, int max_files, int advance_to) {
+    if (running()) return false;
+    if (worker.joinable()) worker.join();
+
+    active = true;
+    background = true;
+    worker = std::thread([this, cfg, from_date, to_date, max_files, advance_to]() {
+        bool ok = run(cfg, from_date, to_date, max_files);
+        failed_at = ok ? 0 : steady_seconds();
+        // The live loop leaves the checkpoint alone while the gap is open, so only this thread writes it
+        if (ok && advance_to > 0) {
+            if (write_checkpoint(cfg, advance_to)) {
+                write_log(cfg.log_file, "Backfill: Checkpoint advanced to " + std::to_string(advance_to));
+            } else {
+                write_log(cfg.log_file, "WARNING: Failed to write checkpoint file " + cfg.checkpoint_file);
+            }
+        }
+        background = false;
+    });
+    return true;
+}
+
+bool Backfiller::retry_due(const Config& cfg) const {
+    int failed = failed_at;
+    return failed == 0 || steady_seconds() - failed >= cfg.retry_interval;
+}
+
+bool Backfiller::run(const Config& cfg, int from_date, int to_date, int max_files) {
+    using clock = std::chrono::steady_clock;
+    active = true;
+
+    write_log(cfg.log_file, "Backfill: Requested range " + std::to_string(from_date) + ".." + std::to_string(to_date));
+
+    std::string error;
+    std::vector<std::string> all_files = list_day_files(cfg, error);
+    if (all_files.empty()) {
+        write_log(cfg.log_file, "Backfill: File listing failed: " + error);
+        active = false;
+        return false;
+    }
+
+    std::vector<FileSlot> slots;
+    for (const auto& f : all_files) {
+        int d = parse_day_file_date(f);
+        if (d >= from_date && d <= to_date) {
+            FileSlot slot;
+            slot.remote = FTP_DATA_DIR + f;
+            slot.local = cfg.local_file + ".backfill." + f;
+            slot.state = SlotState::Pending;
+            slot.bytes = 0;
+            slots.push_back(slot);
+        }
+    }
+    if (max_files > 0 && slots.size() > static_cast<size_t>(max_files)) {
+        write_log(cfg.log_file, "Backfill: Range has " + std::to_string(slots.size()) + " files, keeping newest " +
+                  std::to_string(max_files));
+        slots.erase(slots.begin(), slots.end() - max_files);
+    }
+    if (slots.empty()) {
+        write_log(cfg.log_file, "Backfill: No files in range, nothing to do");
+        active = false;
+        return true;
+    }
+
+    // Dedicated connection so backfill traffic never queues behind (or in front of) live publishes
+    Config bf_cfg = cfg;
+    if (!cfg.mqtt_client_id.empty()) bf_cfg.mqtt_client_id = cfg.mqtt_client_id + "_backfill";
+    if (!cfg.backfill_topic.empty()) bf_cfg.mqtt_topic = cfg.backfill_topic;
+    OutputSink sink;
+    // Reset before the final acknowledgement wait so its last partial batch goes out first
+    std::unique_ptr<MQTTBatcher> batcher(new MQTTBatcher(sink, bf_cfg));
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    size_t next_download = 0;
+    size_t published = 0;
+    bool finished = false;
+    const size_t window = static_cast<size_t>(cfg.backfill_concurrency);
+
+    // Download workers: at most `window` files are downloaded ahead of the publisher
+    std::vector<std::thread> downloaders;
+    size_t worker_count = std::min(window, slots.size());
+    for (size_t w = 0; w < worker_count; ++w) {
+        downloaders.emplace_back([&]() {
+            while (true) {
+                size_t idx;
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    // Timed wait so an external stop() is noticed without a notify
+                    while (!cv.wait_for(lock, std::chrono::milliseconds(200), [&]() {
+                        return finished || stop_requested || next_download >= slots.size() ||
+                               next_download < published + window;
+                    })) {}
+                    if (finished || stop_requested || next_download >= slots.size()) return;
+                    idx = next_download++;
+                }
+                std::string err;
+                bool ok = download_ftp_to(bf_cfg, slots[idx].remote, slots[idx].local, err);
+                long long bytes = ok ? file_size(slots[idx].local) : 0;
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    slots[idx].state = ok ? SlotState::Ready : SlotState::Failed;
+                    slots[idx].bytes = bytes;
+                    slots[idx].error = err;
+                }
+                cv.notify_all();
+            }
+        });
+    }
+
+    // Publish in date order on this thread, paced by the configured rate limit
+    const clock::time_point started = clock::now();
+    clock::time_point last_report = started;
+    clock::time_point next_send = started;
+    const clock::duration send_interval = cfg.backfill_rate_limit > 0
+        ? std::chrono::duration_cast<clock::duration>(std::chrono::microseconds(1000000 / cfg.backfill_rate_limit))
+        : clock::duration::zero();
+
+    long long rows = 0;
+    long long payload_bytes = 0;
+    long long download_bytes = 0;
+    size_t files_done = 0;
+    bool all_ok = true;
+    bool publish_failed = false;
+
+    auto report = [&](const std::string& label) {
+        double secs = std::chrono::duration<double>(clock::now() - started).count();
+        if (secs <= 0) secs = 1e-3;
+        std::string msg = "Backfill " + label + ": files " + std::to_string(files_done) + "/" +
+                          std::to_string(slots.size()) + ", rows " + std::to_string(rows) +
+                          ", " + format_rate(rows / secs, "rows/s") +
+                          ", " + format_rate(payload_bytes / secs, "bytes/s published") +
+                          ", " + format_rate(download_bytes / secs, "bytes/s downloaded");
+        std::cout << msg << std::endl;
+        write_log(cfg.log_file, msg);
+    };
+
+    for (size_t i = 0; i < slots.size(); ++i) {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            while (!cv.wait_for(lock, std::chrono::milliseconds(200), [&]() {
+                return stop_requested || slots[i].state != SlotState::Pending;
+            })) {}
+            if (stop_requested) break;
+        }
+
+        if (slots[i].state == SlotState::Failed) {
+            all_ok = false;
+            write_log(cfg.log_file, "Backfill: Skipping " + slots[i].remote + ": " + slots[i].error);
+        } else {
+            download_bytes += slots[i].bytes;
+            for_each_row(slots[i].local, [&](const std::string& row) {
+                if (store) store->append_row(row, true);
+                if (send_interval != clock::duration::zero()) {
+                    clock::time_point now = clock::now();
+                    if (now < next_send) std::this_thread::sleep_until(next_send);
+                    next_send = std::max(now, next_send) + send_interval;
+                }
+                if (ring) ring->write(row, LOCAL_RING_BACKFILL);
+                if (!batcher->add(row)) {
+                    publish_failed = true;
+                    return false;
+                }
+                rows++;
+                payload_bytes += static_cast<long long>(row.size());
+
+                if (clock::now() - last_report >= std::chrono::seconds(10)) {
+                    last_report = clock::now();
+                    report("progress");
+                }
+                return !stop_requested;
+            });
+            std::remove(slots[i].local.c_str());
+            if (publish_failed) {
+                write_log(cfg.log_file, "Backfill: MQTT publish failed in " + slots[i].remote + ", aborting");
+                break;
+            }
+            write_log(cfg.log_file, "Backfill: Published " + slots[i].remote);
+        }
+        files_done++;
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            published = i + 1;
+        }
+        cv.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        finished = true;
+    }
+    cv.notify_all();
+    for (auto& t : downloaders) t.join();
+    for (const auto& slot : slots) std::remove(slot.local.c_str());
+
+    batcher.reset();
+    if (!sink.flush(bf_cfg, 10000)) {
+        write_log(cfg.log_file, "Backfill: WARNING: Not all messages confirmed by broker before disconnect");
+    }
+    if (files_done < slots.size()) all_ok = false;
+
+    report(all_ok ? "complete" : "finished with errors");
+    active = false;
+    return all_ok;
+}
+
+// Advance the live checkpoint, or backfill the missed days first if it is more than a day behind
+void update_checkpoint(const Config& cfg, const std::string& remote_filename, Backfiller& backfiller) {
+    int date = parse_day_file_date(remote_filename.substr(remote_filename.rfind('/') + 1));
+    if (date < 0) return;
+
+    int previous = read_checkpoint(cfg);
+    if (date <= previous) return;
+
+    int gap_from = previous > 0 ? add_days(previous, 1) : 0;
+    int gap_to = add_days(date, -1);
+    if (cfg.backfill_auto && previous > 0 && gap_from <= gap_to) {
+        // The checkpoint stays at previous until the backfill has published the gap; a running
+        // backfill is left alone, a failed one is retried after RETRY_INTERVAL
+        if (backfiller.running() || !backfiller.retry_due(cfg)) return;
+        if (backfiller.start(cfg, gap_from, gap_to, cfg.backfill_max_files, date)) {
+            write_log(cfg.log_file, "Checkpoint gap detected (" + std::to_string(previous) + " -> " +
+                      std::to_string(date) + "), started background backfill of " +
+                      std::to_string(gap_from) + ".." + std::to_string(gap_to));
+        }
+        return;
+    }
+    if (!write_checkpoint(cfg, date)) {
+        write_log(cfg.log_file, "WARNING: Failed to write checkpoint file " + cfg.checkpoint_file);
+    }
+}
+
+bool parse_backfill_range(const std::string& spec, int& from_date, int& to_date) {
+    size_t sep = spec.find("..");
+    if (sep == std::string::npos) return false;
+    // Reuse the filename parser so the CLI accepts exactly the controller's date formats
+    from_date = parse_day_file_date("day" + spec.substr(0, sep) + ".dat");
+    to_date = parse_day_file_date("day" + spec.substr(sep + 2) + ".dat");
+    return from_date > 0 && to_date > 0 && from_date <= to_date;
+}
+
+int read_checkpoint(const Config& cfg) {
+    if (cfg.checkpoint_file.empty()) return -1;
+    std::ifstream ifs(cfg.checkpoint_file);
+    int date = -1;
+    if (!(ifs >> date)) return -1;
+    return date;
+}
+
+bool write_checkpoint(const Config& cfg, int date) {
+    if (cfg.checkpoint_file.empty()) return false;
+    std::string tmp = cfg.checkpoint_file + ".tmp";
+    {
+        std::ofstream ofs(tmp, std::ios::trunc);
+        if (!ofs.is_open()) return false;
+        ofs << date << std::endl;
+        if (!ofs) return false;
+    }
+    return std::rename(tmp.c_str(), cfg.checkpoint_file.c_str()) == 0;
+}
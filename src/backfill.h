@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include "config.h"
+
+class TimeSeriesStore;
+class LocalRing;
+
+// Historical backfill: re-publishes every row of the dayDDMMYY.dat files in a date range.
+// Files are downloaded with bounded concurrency into their own temp paths and published in
+// date order over a dedicated MQTT connection, so the live loop is never delayed.
+class Backfiller {
+public:
+    Backfiller();
+    ~Backfiller();
+
+    // Run a backfill of [from_date, to_date] (YYYYMMDD keys, inclusive) on the calling thread.
+    // When max_files > 0 only the newest max_files files of the range are processed.
+    // Returns true if every file in the range was published.
+    bool run(const Config& cfg, int from_date, int to_date, int max_files = 0);
+
+    // Same as run() but on a background thread. Returns false if a backfill is already running.
+    // With advance_to > 0 the live checkpoint is moved to advance_to once the run succeeds.
+    bool start(const Config& cfg, int from_date, int to_date, int max_files = 0, int advance_to = 0);
+
+    bool running() const { return active || background; }
+
+    // False while a background run failed less than RETRY_INTERVAL ago
+    bool retry_due(const Config& cfg) const;
+
+    // Also append backfilled rows to the on-device store (may be null)
+    void set_store(TimeSeriesStore* ts_store) { store = ts_store; }
+
+    // Also write backfilled rows to the local shared-memory ring (may be null)
+    void set_local_ring(LocalRing* local_ring) { ring = local_ring; }
+
+    // Ask a running backfill to stop after the current row and wait for it
+    void stop();
+
+private:
+    std::thread worker;
+    TimeSeriesStore* store;
+    LocalRing* ring;
+    std::atomic<bool> active;
+    std::atomic<bool> background;           // start()'s thread, until its checkpoint is written
+    std::atomic<bool> stop_requested;
+    std::atomic<int> failed_at;             // steady clock seconds (32-bit: MIPS has no 64-bit atomics); 0 after success
+};
+
+// Parse a "FROM..TO" range of DDMMYY or DDMMYYYY dates into YYYYMMDD keys
+bool parse_backfill_range(const std::string& spec, int& from_date, int& to_date);
+
+// Date (YYYYMMDD) of the last day file published by the live loop, or -1 if unknown
+int read_checkpoint(const Config& cfg);
+
+// Record the date (YYYYMMDD) of the day file just published by the live loop
+bool write_checkpoint(const Config& cfg, int date);
+
+// Advance the live checkpoint after remote_filename was published. If the previous checkpoint
+// is more than a day behind, the missed days are backfilled in the background instead and the
+// checkpoint only moves once that backfill succeeds, so a failed one is retried.
+void update_checkpoint(const Config& cfg, const std::string& remote_filename, Backfiller& backfiller);
@@ -2,7 +2,10 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
 #include <json/json.h>
+#include "alarm.h"
+#include "output_sink.h"
 
 bool Config::load_from_file(const std::string& path) {
     std::ifstream ifs(path);
@@ -28,17 +31,69 @@ bool Config::load_from_file(const std::string& path) {
         ftp_user = root.get("FTP_USER", "").asString();
         ftp_pass = root.get("FTP_PASS", "").asString();
         local_file = root.get("LOCAL_FILE", "").asString();
+        ftp_tls = root.get("FTP_TLS", ftp_tls).asString();
+        ftp_ca_file = root.get("FTP_CA_FILE", "").asString();
+        ftp_tcp_nodelay = root.get("FTP_TCP_NODELAY", ftp_tcp_nodelay).asBool();
+        ftp_tcp_keepalive = root.get("FTP_TCP_KEEPALIVE", ftp_tcp_keepalive).asInt();
 
         mqtt_server = root.get("MQTT_SERVER", "").asString();
         mqtt_client_id = root.get("MQTT_CLIENT_ID", "").asString();
         mqtt_topic = root.get("MQTT_TOPIC", "").asString();
         mqtt_user = root.get("MQTT_USER", "").asString();
         mqtt_pass = root.get("MQTT_PASS", "").asString();
+        mqtt_persistent_session = root.get("MQTT_PERSISTENT_SESSION", mqtt_persistent_session).asBool();
+        mqtt_batch_max_bytes = root.get("MQTT_BATCH_MAX_BYTES", mqtt_batch_max_bytes).asInt();
+        mqtt_batch_linger_ms = root.get("MQTT_BATCH_LINGER_MS", mqtt_batch_linger_ms).asInt();
+        mqtt_tls = root.get("MQTT_TLS", mqtt_tls).asBool();
+        mqtt_ca_file = root.get("MQTT_CA_FILE", "").asString();
+        mqtt_cert_file = root.get("MQTT_CERT_FILE", "").asString();
+        mqtt_key_file = root.get("MQTT_KEY_FILE", "").asString();
+        mqtt_keepalive = root.get("MQTT_KEEPALIVE", mqtt_keepalive).asInt();
+        mqtt_tcp_nodelay = root.get("MQTT_TCP_NODELAY", mqtt_tcp_nodelay).asBool();
+        tls_session_cache = root.get("TLS_SESSION_CACHE", tls_session_cache).asBool();
+
+        output_sinks = root.get("OUTPUT_SINKS", "").asString();
+        output_file = root.get("OUTPUT_FILE", local_file + ".out").asString();
 
         poll_interval = root.get("POLL_INTERVAL", poll_interval).asInt();
         retry_interval = root.get("RETRY_INTERVAL", retry_interval).asInt();
+        connect_timeout = root.get("CONNECT_TIMEOUT", connect_timeout).asInt();
+        ftp_timeout = root.get("FTP_TIMEOUT", ftp_timeout).asInt();
+        retry_backoff_base = root.get("RETRY_BACKOFF_BASE", retry_backoff_base).asInt();
+        circuit_failure_threshold = root.get("CIRCUIT_FAILURE_THRESHOLD", circuit_failure_threshold).asInt();
+        circuit_probe_interval = root.get("CIRCUIT_PROBE_INTERVAL", circuit_probe_interval).asInt();
+        config_watch = root.get("CONFIG_WATCH", config_watch).asBool();
+        pipeline_queue_depth = root.get("PIPELINE_QUEUE_DEPTH", pipeline_queue_depth).asInt();
+        cycle_budget_ms = root.get("CYCLE_BUDGET_MS", cycle_budget_ms).asInt();
+        discover_budget_ms = root.get("DISCOVER_BUDGET_MS", discover_budget_ms).asInt();
+        download_budget_ms = root.get("DOWNLOAD_BUDGET_MS", download_budget_ms).asInt();
+        publish_budget_ms = root.get("PUBLISH_BUDGET_MS", publish_budget_ms).asInt();
+
+        alarm_rules = root.get("ALARM_RULES", "").asString();
+        alarm_topic = root.get("ALARM_TOPIC", mqtt_topic + "/alarm").asString();
+        alarm_poll_interval = root.get("ALARM_POLL_INTERVAL", alarm_poll_interval).asInt();
+
+        checkpoint_file = root.get("CHECKPOINT_FILE", local_file + ".checkpoint").asString();
+        backfill_auto = root.get("BACKFILL_AUTO", backfill_auto).asBool();
+        backfill_concurrency = root.get("BACKFILL_CONCURRENCY", backfill_concurrency).asInt();
+        backfill_rate_limit = root.get("BACKFILL_RATE_LIMIT", backfill_rate_limit).asInt();
+        backfill_max_files = root.get("BACKFILL_MAX_FILES", backfill_max_files).asInt();
+        backfill_topic = root.get("BACKFILL_TOPIC", mqtt_topic).asString();
+
+        ts_store_dir = root.get("TS_STORE_DIR", "").asString();
+        ts_store_fields = root.get("TS_STORE_FIELDS", ts_store_fields).asInt();
+        ts_store_max_mb = root.get("TS_STORE_MAX_MB", ts_store_max_mb).asInt();
+        ts_store_max_age_days = root.get("TS_STORE_MAX_AGE_DAYS", ts_store_max_age_days).asInt();
+
+        local_ring_path = root.get("LOCAL_RING_PATH", "").asString();
+        local_ring_slots = root.get("LOCAL_RING_SLOTS", local_ring_slots).asInt();
+        local_ring_slot_bytes = root.get("LOCAL_RING_SLOT_BYTES", local_ring_slot_bytes).asInt();
+        local_ring_notify = root.get("LOCAL_RING_NOTIFY", local_ring_notify).asBool();
 
         log_file = root.get("LOG_FILE", "app.log").asString();
+        heap_profile_auto = root.get("HEAP_PROFILE_AUTO", heap_profile_auto).asBool();
+        heap_profile_sample_bytes = root.get("HEAP_PROFILE_SAMPLE_BYTES", heap_profile_sample_bytes).asInt();
+        heap_profile_file = root.get("HEAP_PROFILE_FILE", log_file + ".heap").asString();
         app_username = root.get("APP_USERNAME", "").asString();
         app_password = root.get("APP_PASSWORD", "").asString();
     } catch (const std::exception& e) {
@@ -51,10 +106,60 @@ bool Config::load_from_file(const std::string& path) {
         std::cerr << "Incomplete FTP configuration in " << path << std::endl;
         return false;
     }
-    if (mqtt_server.empty() || mqtt_topic.empty()) {
+    std::string sinks_error;
+    if (!check_output_sinks(output_sinks, sinks_error)) {
+        std::cerr << "Invalid OUTPUT_SINKS in " << path << ": " << sinks_error << std::endl;
+        return false;
+    }
+    // The topic names every stream in any sink; the broker address matters only when MQTT is
+    // built in and active
+    bool need_server = false;
+#ifdef ENABLE_MQTT
+    need_server = sink_enabled(*this, MQTTPublisher::name());
+#endif
+    if ((need_server && mqtt_server.empty()) || mqtt_topic.empty()) {
         std::cerr << "Incomplete MQTT configuration in " << path << std::endl;
         return false;
     }
 
+    if (ftp_tls != "try" && ftp_tls != "require" && ftp_tls != "off") {
+        std::cerr << "Invalid FTP_TLS in " << path << ": " << ftp_tls << " (expected try, require or off)" << std::endl;
+        return false;
+    }
+
+    std::vector<AlarmRule> rules;
+    std::string rules_error;
+    if (!parse_alarm_rules(alarm_rules, rules, rules_error)) {
+        std::cerr << "Invalid ALARM_RULES in " << path << ": " << rules_error << std::endl;
+        return false;
+    }
+
+    if (ftp_tcp_keepalive < 0) ftp_tcp_keepalive = 0;
+    if (mqtt_keepalive < 5) mqtt_keepalive = 5;         // libmosquitto rejects shorter ones
+    if (mqtt_keepalive > 65535) mqtt_keepalive = 65535;
+    if (connect_timeout < 1) connect_timeout = 1;
+    if (ftp_timeout < connect_timeout) ftp_timeout = connect_timeout;
+    if (retry_backoff_base < 1) retry_backoff_base = 1;
+    if (retry_interval < retry_backoff_base) retry_interval = retry_backoff_base;
+    if (circuit_failure_threshold < 1) circuit_failure_threshold = 1;
+    if (circuit_probe_interval < 1) circuit_probe_interval = 1;
+    if (heap_profile_sample_bytes < 1024) heap_profile_sample_bytes = 1024;
+    if (ts_store_fields < 1) ts_store_fields = 1;
+    if (ts_store_fields > 64) ts_store_fields = 64;
+    if (local_ring_slots < 2) local_ring_slots = 2;
+    if (local_ring_slots > 65536) local_ring_slots = 65536;
+    if (local_ring_slot_bytes < 128) local_ring_slot_bytes = 128;
+    if (local_ring_slot_bytes > 65536) local_ring_slot_bytes = 65536;
+    if (alarm_poll_interval < 1) alarm_poll_interval = 1;
+    if (pipeline_queue_depth < 1) pipeline_queue_depth = 1;
+    if (cycle_budget_ms < 0) cycle_budget_ms = 0;
+    if (discover_budget_ms < 0) discover_budget_ms = 0;
+    if (download_budget_ms < 0) download_budget_ms = 0;
+    if (publish_budget_ms < 0) publish_budget_ms = 0;
+    if (backfill_concurrency < 1) backfill_concurrency = 1;
+    if (backfill_rate_limit < 0) backfill_rate_limit = 0;
+    if (mqtt_batch_max_bytes < 0) mqtt_batch_max_bytes = 0;
+    if (mqtt_batch_linger_ms < 1) mqtt_batch_linger_ms = 1;
+
     return true;
 }
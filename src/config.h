@@ -7,15 +7,80 @@ struct Config {
     std::string ftp_user;
     std::string ftp_pass;
     std::string local_file;
+    std::string ftp_tls{"try"};         // FTPS: "try" (upgrade if offered), "require" or "off"
+    std::string ftp_ca_file;            // CA bundle for the controller's certificate, empty = system store
+    bool ftp_tcp_nodelay{false};        // disable Nagle on FTP connections
+    int ftp_tcp_keepalive{0};           // TCP keepalive idle/interval, seconds, 0 = off
 
     std::string mqtt_server;
     std::string mqtt_client_id;
     std::string mqtt_topic;
     std::string mqtt_user;
     std::string mqtt_pass;
+    bool mqtt_persistent_session{false};  // clean_session=false with the stable MQTT_CLIENT_ID
+    int mqtt_batch_max_bytes{0};          // coalesce rows into one message up to this size, 0 = off
+    int mqtt_batch_linger_ms{500};        // flush a partial batch after this long
+    bool mqtt_tls{false};                 // also on for ssl:// and mqtts:// servers (default port 8883)
+    std::string mqtt_ca_file;             // CA for the broker's certificate, empty = system store
+    std::string mqtt_cert_file;           // client certificate (PEM), optional
+    std::string mqtt_key_file;            // its key, defaults to the certificate file
+    int mqtt_keepalive{60};               // MQTT keepalive, seconds
+    bool mqtt_tcp_nodelay{false};         // disable Nagle on the broker connection
+
+    // Resume TLS sessions on reconnect (FTPS and MQTTS), see tls_session.h
+    bool tls_session_cache{true};
+
+    // Output sinks (see output_sink.h); only matters when more than one is compiled in
+    std::string output_sinks;           // comma-separated names to use, empty = all compiled in
+    std::string output_file;            // file sink target, defaults to LOCAL_FILE.out
 
     int poll_interval{300};
-    int retry_interval{120};
+    int retry_interval{120};            // longest backoff between failed attempts
+
+    // Retries: connect timeout, exponential backoff and per-host circuit breaker
+    int connect_timeout{5};             // TCP connect (FTP, MQTT and circuit probes), seconds
+    int ftp_timeout{30};                // whole FTP transfer, seconds
+    int retry_backoff_base{2};          // first backoff step, doubled per failure, seconds
+    int circuit_failure_threshold{3};   // consecutive failures before a host is marked down
+    int circuit_probe_interval{5};      // TCP probe cadence while a host is down, seconds
+    bool config_watch{true};            // reload when the file changes (SIGHUP always reloads)
+    int pipeline_queue_depth{4};        // cycles buffered between fetch, parse and publish stages
+
+    // Time budget of one poll cycle and of its phases, milliseconds (0 = no limit)
+    int cycle_budget_ms{60000};         // fetch start to publish acknowledged
+    int discover_budget_ms{15000};      // FTP directory listing
+    int download_budget_ms{30000};      // FTP download of the day file
+    int publish_budget_ms{10000};       // sink publish, including the wait for the broker ack
+
+    // Alarm fast path: rules checked on every parsed row (empty = disabled)
+    std::string alarm_rules;            // e.g. "0>1000; 0/s>0.5", see alarm.h
+    std::string alarm_topic;            // defaults to mqtt_topic + "/alarm"
+    int alarm_poll_interval{15};        // poll interval while an alarm is active, seconds
+
+    // Historical backfill of days missed during an outage
+    std::string checkpoint_file;        // last day file published by the live loop
+    bool backfill_auto{true};           // backfill automatically when the checkpoint shows a gap
+    int backfill_concurrency{2};        // parallel FTP downloads
+    int backfill_rate_limit{50};        // rows per second published, 0 = unlimited
+    int backfill_max_files{31};         // cap for automatic backfill (newest files win)
+    std::string backfill_topic;         // defaults to mqtt_topic
+
+    // On-device time-series store (empty directory = disabled)
+    std::string ts_store_dir;
+    int ts_store_fields{8};             // numeric columns kept per row
+    int ts_store_max_mb{16};
+    int ts_store_max_age_days{30};
+
+    // Shared-memory ring for local consumers (empty path = disabled)
+    std::string local_ring_path;
+    int local_ring_slots{256};
+    int local_ring_slot_bytes{1024};    // per slot, including a 32-byte record header
+    bool local_ring_notify{true};       // also notify readers on LOCAL_RING_PATH.sock
+
+    // Sampling heap profiler, started when the memory leak detector fires
+    bool heap_profile_auto{true};
+    int heap_profile_sample_bytes{131072};  // mean bytes allocated between samples
+    std::string heap_profile_file;          // pprof output, defaults to LOG_FILE.heap
 
     std::string log_file;
     std::string app_username;
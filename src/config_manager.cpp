@@ -0,0 +1,124 @@
+#include "config_manager.h"
+#include "utils.h"
+#include <csignal>
+#include <iostream>
+#include <chrono>
+#include <sys/stat.h>
+
+namespace {
+
+volatile std::sig_atomic_t reload_requested = 0;
+
+void on_sighup(int) {
+    reload_requested = 1;
+}
+
+} // namespace
+
+ConfigManager::ConfigManager(const std::string& path)
+    : path(path), stopping(false), generation(0), last_mtime(0), last_size(0) {}
+
+ConfigManager::~ConfigManager() {
+    stop_watching();
+}
+
+bool ConfigManager::load() {
+    file_changed(); // record the initial mtime so the watcher does not reload immediately
+    std::shared_ptr<Config> cfg = std::make_shared<Config>();
+    if (!cfg->load_from_file(path)) return false;
+    std::atomic_store(&snapshot, std::shared_ptr<const Config>(cfg));
+    return true;
+}
+
+std::shared_ptr<const Config> ConfigManager::current() const {
+    return std::atomic_load(&snapshot);
+}
+
+bool ConfigManager::reload() {
+    std::shared_ptr<const Config> old_cfg = current();
+    std::shared_ptr<Config> cfg = std::make_shared<Config>();
+    if (!cfg->load_from_file(path)) {
+        std::string msg = "Config reload: " + path + " is invalid, keeping the active configuration";
+        std::cerr << msg << std::endl;
+        if (old_cfg) write_log(old_cfg->log_file, msg);
+        return false;
+    }
+
+    std::atomic_store(&snapshot, std::shared_ptr<const Config>(cfg));
+    {
+        std::lock_guard<std::mutex> lock(change_mtx);
+        generation++;
+    }
+    change_cv.notify_all();
+    write_log(cfg->log_file, "Config reload: Installed new configuration from " + path);
+    return true;
+}
+
+bool ConfigManager::wait_for_change(std::chrono::seconds timeout) {
+    std::unique_lock<std::mutex> lock(change_mtx);
+    unsigned long seen = generation;
+    return change_cv.wait_for(lock, timeout, [&]() { return generation != seen; });
+}
+
+void ConfigManager::start_watching(bool watch_file) {
+    if (watcher.joinable()) return;
+
+    struct sigaction sa;
+    sa.sa_handler = on_sighup;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGHUP, &sa, nullptr);
+
+    stopping = false;
+    watcher = std::thread(&ConfigManager::watch_loop, this, watch_file);
+}
+
+void ConfigManager::stop_watching() {
+    stopping = true;
+    if (watcher.joinable()) watcher.join();
+}
+
+bool ConfigManager::file_changed() {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return false;
+    bool changed = st.st_mtime != last_mtime || st.st_size != last_size;
+    last_mtime = st.st_mtime;
+    last_size = st.st_size;
+    return changed;
+}
+
+void ConfigManager::watch_loop(bool watch_file) {
+    while (!stopping) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+
+        bool signalled = reload_requested != 0;
+        reload_requested = 0;
+        bool modified = file_changed() && watch_file;
+        if (signalled || modified) {
+            reload();
+        }
+    }
+}
+
+bool mqtt_settings_changed(const Config& a, const Config& b) {
+    return a.mqtt_server != b.mqtt_server ||
+           a.mqtt_client_id != b.mqtt_client_id ||
+           a.mqtt_user != b.mqtt_user ||
+           a.mqtt_pass != b.mqtt_pass ||
+           a.mqtt_persistent_session != b.mqtt_persistent_session ||
+           a.mqtt_tls != b.mqtt_tls ||
+           a.mqtt_ca_file != b.mqtt_ca_file ||
+           a.mqtt_cert_file != b.mqtt_cert_file ||
+           a.mqtt_key_file != b.mqtt_key_file ||
+           a.mqtt_keepalive != b.mqtt_keepalive ||
+           a.mqtt_tcp_nodelay != b.mqtt_tcp_nodelay ||
+           a.tls_session_cache != b.tls_session_cache;
+}
+
+bool schedule_settings_changed(const Config& a, const Config& b) {
+    return a.poll_interval != b.poll_interval ||
+           a.alarm_poll_interval != b.alarm_poll_interval ||
+           a.retry_interval != b.retry_interval ||
+           a.retry_backoff_base != b.retry_backoff_base ||
+           a.circuit_probe_interval != b.circuit_probe_interval;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <ctime>
+#include "config.h"
+
+// Owns the active configuration as an immutable snapshot. A watcher thread reloads the file
+// on SIGHUP or when its modification time changes, validates it off the hot path and installs
+// the new snapshot with an atomic swap. Readers take a snapshot with current() once per cycle.
+class ConfigManager {
+public:
+    explicit ConfigManager(const std::string& path);
+    ~ConfigManager();
+
+    // Initial load; returns false if the file is missing or invalid
+    bool load();
+
+    // Currently active snapshot (never null after a successful load())
+    std::shared_ptr<const Config> current() const;
+
+    // Re-read and validate the file; the active snapshot is only replaced if it is valid
+    bool reload();
+
+    // Install the SIGHUP handler and start the watcher thread. When watch_file is true
+    // the file's modification time is also polled once per second.
+    void start_watching(bool watch_file);
+    void stop_watching();
+
+    // Sleep for the given time, returning early (true) if a new snapshot is installed meanwhile
+    bool wait_for_change(std::chrono::seconds timeout);
+
+private:
+    void watch_loop(bool watch_file);
+    bool file_changed();
+
+    std::string path;
+    std::shared_ptr<const Config> snapshot;   // accessed with std::atomic_load/atomic_store
+    std::thread watcher;
+    std::atomic<bool> stopping;
+    std::mutex change_mtx;
+    std::condition_variable change_cv;
+    unsigned long generation;
+    time_t last_mtime;
+    off_t last_size;
+};
+
+// Settings groups, used to restart only the subsystems a reload actually touched
+bool mqtt_settings_changed(const Config& a, const Config& b);
+// Poll and retry timing; only these end a wait between cycles early
+bool schedule_settings_changed(const Config& a, const Config& b);
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+// Point in time by which a cycle (or one phase of it) must be done, plus an optional flag
+// that cancels the work early (pipeline shutdown). Long operations take a Deadline and cap
+// their own timeouts with remaining_ms(); curl transfers also poll it from their progress
+// callback. A default-constructed Deadline has no limit, so only the fixed timeouts apply.
+class Deadline {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    Deadline() : limited(false), cancel(nullptr) {}
+
+    // budget_ms from now; budget_ms <= 0 gives no limit
+    static Deadline in(long long budget_ms, const std::atomic<bool>* cancel_flag = nullptr) {
+        Deadline d;
+        d.cancel = cancel_flag;
+        if (budget_ms > 0) {
+            d.limited = true;
+            d.end = clock::now() + std::chrono::milliseconds(budget_ms);
+        }
+        return d;
+    }
+
+    // A phase of this deadline: ends budget_ms from now or with this deadline, whichever is
+    // first (budget_ms <= 0: with this deadline)
+    Deadline phase(long long budget_ms) const {
+        Deadline d = *this;
+        if (budget_ms > 0) {
+            clock::time_point phase_end = clock::now() + std::chrono::milliseconds(budget_ms);
+            d.end = limited ? std::min(end, phase_end) : phase_end;
+            d.limited = true;
+        }
+        return d;
+    }
+
+    bool is_limited() const { return limited; }
+    bool expired() const { return limited && clock::now() >= end; }
+    bool cancelled() const { return cancel && cancel->load(); }
+    // Checked by long operations: stop now, either way
+    bool should_stop() const { return expired() || cancelled(); }
+
+    // Milliseconds left, rounded up so a wait of that long ends past the deadline; capped at
+    // cap_ms (cap_ms <= 0: no cap) and at least 1, since 0 means "no timeout" to curl
+    long long remaining_ms(long long cap_ms) const {
+        if (!limited) return cap_ms;
+        long long left = (std::chrono::duration_cast<std::chrono::microseconds>(end - clock::now()).count() + 999) / 1000;
+        if (cap_ms > 0) left = std::min(left, cap_ms);
+        return std::max(1LL, left);
+    }
+
+private:
+    bool limited;
+    clock::time_point end;
+    const std::atomic<bool>* cancel;
+};
@@ -1,5 +1,6 @@
 #include "ftp_downloader.h"
 #include "utils.h"
+#include "tls_session.h"
 #include <curl/curl.h>
 #include <cstdio>
 #include <iostream>
@@ -20,7 +21,70 @@ static size_t write_data(void* ptr, size_t size, size_t nmemb, FILE* stream) {
     return fwrite(ptr, size, nmemb, stream);
 }
 
-bool download_ftp(const Config& cfg, const std::string& remote_filename, std::string& error_out) {
+static int xferinfo_callback(void* clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+    // Non-zero aborts the transfer with CURLE_ABORTED_BY_CALLBACK
+    return static_cast<const Deadline*>(clientp)->should_stop() ? 1 : 0;
+}
+
+// Cap the transfer's timeouts at what is left of the deadline; the progress callback (called
+// at least once a second, also while stalled) aborts it once the deadline passes or is cancelled
+static void apply_deadline(CURL* curl, const Config& cfg, const Deadline& deadline) {
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, static_cast<long>(deadline.remaining_ms(cfg.connect_timeout * 1000LL)));
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, static_cast<long>(deadline.remaining_ms(cfg.ftp_timeout * 1000LL)));
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, xferinfo_callback);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, const_cast<Deadline*>(&deadline));
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+}
+
+// Why a transfer failed; one cut short by its deadline says so instead of curl's timeout text
+static std::string transfer_error(CURLcode res, const Deadline& deadline) {
+    if (deadline.cancelled()) return "cancelled";
+    if (deadline.expired()) return "deadline exceeded";
+    return curl_easy_strerror(res);
+}
+
+// True if the controller could not be reached at all: resolve or connect failed, or the
+// transfer timed out before the control connection was up
+static bool is_connect_failure(CURL* curl, CURLcode res) {
+    if (res == CURLE_COULDNT_RESOLVE_HOST || res == CURLE_COULDNT_CONNECT) return true;
+    if (res != CURLE_OPERATION_TIMEDOUT) return false;
+    double connect_time = 0;
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connect_time);
+    return connect_time <= 0;
+}
+
+// Only an unreachable controller counts against its circuit breaker. Any other error (login
+// denied, missing file, a stalled transfer) came from a host that answered and is retried after
+// the flat RETRY_INTERVAL. A transfer cut short by its own deadline or cancelled says nothing
+// about the host at all: a slow but healthy link must not trip the breaker.
+static void record_outcome(const Config& cfg, CURL* curl, CURLcode res, const Deadline& deadline) {
+    if (res != CURLE_OK && deadline.should_stop()) return;
+    if (res != CURLE_OK && is_connect_failure(curl, res)) {
+        ftp_host_health(cfg).record_failure(cfg, transfer_error(res, deadline));
+    } else {
+        ftp_host_health(cfg).record_success(cfg);
+    }
+}
+
+HostHealth& ftp_host_health(const Config& cfg) {
+    std::string host;
+    int port = 21;
+    split_host_port(cfg.ftp_host, 21, host, port);
+    return host_health("FTP", host, port);
+}
+
+bool download_ftp(const Config& cfg, const std::string& remote_filename, std::string& error_out,
+                  const Deadline& deadline) {
+    return download_ftp_to(cfg, remote_filename, cfg.local_file, error_out, deadline);
+}
+
+bool download_ftp_to(const Config& cfg, const std::string& remote_filename, const std::string& local_path,
+                     std::string& error_out, const Deadline& deadline) {
+    if (deadline.should_stop()) {
+        error_out = "FTP Download Failed: " + transfer_error(CURLE_OK, deadline);
+        return false;
+    }
+
     auto curl_deleter = [](CURL* c) { if (c) curl_easy_cleanup(c); };
     std::unique_ptr<CURL, decltype(curl_deleter)> curl(curl_easy_init(), curl_deleter);
 
@@ -33,7 +97,7 @@ bool download_ftp(const Config& cfg, const std::string& remote_filename, std::st
 
     bool success = false;
     std::string url = "ftp://" + cfg.ftp_host + remote_filename;
-    std::string tmp_local = cfg.local_file + ".tmp";
+    std::string tmp_local = local_path + ".tmp";
 
     auto file_deleter = [](FILE* f) { if (f) fclose(f); };
     std::unique_ptr<FILE, decltype(file_deleter)> fp(fopen(tmp_local.c_str(), "wb"), file_deleter);
@@ -49,15 +113,16 @@ bool download_ftp(const Config& cfg, const std::string& remote_filename, std::st
     curl_easy_setopt(curl.get(), CURLOPT_PASSWORD, cfg.ftp_pass.c_str());
     curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, write_data);
     curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, fp.get());
-    curl_easy_setopt(curl.get(), CURLOPT_TIMEOUT, 30L);
-    curl_easy_setopt(curl.get(), CURLOPT_USE_SSL, CURLUSESSL_TRY);
+    apply_deadline(curl.get(), cfg, deadline);
+    // A new connection per transfer; TLS sessions are resumed through the shared cache instead
+    apply_ftp_link_options(curl.get(), cfg);
     curl_easy_setopt(curl.get(), CURLOPT_MAXAGE_CONN, 1L);
-    curl_easy_setopt(curl.get(), CURLOPT_TCP_NODELAY, 0L);
     curl_easy_setopt(curl.get(), CURLOPT_FRESH_CONNECT, 1L);
     curl_easy_setopt(curl.get(), CURLOPT_FORBID_REUSE, 1L);
 
     CURLcode res = curl_easy_perform(curl.get());
-    
+    record_outcome(cfg, curl.get(), res, deadline);
+
     // Explicitly close file before renaming/removing
     fp.reset();
 
@@ -66,14 +131,14 @@ bool download_ftp(const Config& cfg, const std::string& remote_filename, std::st
         curl_easy_getinfo(curl.get(), CURLINFO_SIZE_DOWNLOAD, &dl);
         write_log(cfg.log_file, "curl_easy_perform Success. Size: " + std::to_string((long)dl) + " bytes");
         
-        if (std::rename(tmp_local.c_str(), cfg.local_file.c_str()) != 0) {
+        if (std::rename(tmp_local.c_str(), local_path.c_str()) != 0) {
             error_out = "Failed to rename temp file to final path";
             write_log(cfg.log_file, error_out);
         } else {
             success = true;
         }
     } else {
-        error_out = std::string("FTP Download Failed: ") + curl_easy_strerror(res);
+        error_out = "FTP Download Failed: " + transfer_error(res, deadline);
         write_log(cfg.log_file, error_out);
         std::remove(tmp_local.c_str());
     }
@@ -85,18 +150,54 @@ bool download_ftp(const Config& cfg, const std::string& remote_filename, std::st
     return success;
 }
 
-std::string discover_latest_file(const Config& cfg, std::string& error_out) {
+int parse_day_file_date(const std::string& filename) {
+    // Filenames are expected to contain a date like dayDDMMYY.dat or dayDDMMYYYY.dat.
+    // Encode it as YYYYMMDD so 15 Feb 2026 (150226) > 31 Jan 2026 (310126).
+    std::string lower = filename;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    size_t pos = lower.find("day");
+    if (pos == std::string::npos) return -1;
+    pos += 3;
+    size_t dot = lower.rfind(".dat");
+    if (dot == std::string::npos || dot <= pos) return -1;
+    std::string numpart = lower.substr(pos, dot - pos);
+    std::string digits;
+    for (char c : numpart) if (std::isdigit((unsigned char)c)) digits.push_back(c);
+    int dd, mm, year;
+    if (digits.size() == 6) {
+        // DDMMYY
+        dd = std::stoi(digits.substr(0,2));
+        mm = std::stoi(digits.substr(2,2));
+        year = 2000 + std::stoi(digits.substr(4,2)); // assume 2000s
+    } else if (digits.size() == 8) {
+        // DDMMYYYY
+        dd = std::stoi(digits.substr(0,2));
+        mm = std::stoi(digits.substr(2,2));
+        year = std::stoi(digits.substr(4,4));
+    } else {
+        return -1;
+    }
+    return year * 10000 + mm * 100 + dd;
+}
+
+std::vector<std::string> list_day_files(const Config& cfg, std::string& error_out, const Deadline& deadline) {
+    std::vector<std::string> day_files;
+    if (deadline.should_stop()) {
+        error_out = "FTP List Failed: " + transfer_error(CURLE_OK, deadline);
+        return day_files;
+    }
+
     auto curl_deleter = [](CURL* c) { if (c) curl_easy_cleanup(c); };
     std::unique_ptr<CURL, decltype(curl_deleter)> curl(curl_easy_init(), curl_deleter);
 
     if (!curl) {
         error_out = "Failed to initialize curl for discovery";
-        return "";
+        return day_files;
     }
 
     std::string file_list;
     // The directory containing records
-    std::string url = "ftp://" + cfg.ftp_host + "/CFDisk/mindata/";
+    std::string url = "ftp://" + cfg.ftp_host + FTP_DATA_DIR;
 
     curl_easy_setopt(curl.get(), CURLOPT_URL, url.c_str());
     curl_easy_setopt(curl.get(), CURLOPT_USERNAME, cfg.ftp_user.c_str());
@@ -104,18 +205,19 @@ std::string discover_latest_file(const Config& cfg, std::string& error_out) {
     curl_easy_setopt(curl.get(), CURLOPT_DIRLISTONLY, 1L);
     curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, list_callback);
     curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, &file_list);
-    curl_easy_setopt(curl.get(), CURLOPT_TIMEOUT, 30L);
+    apply_deadline(curl.get(), cfg, deadline);
+    apply_ftp_link_options(curl.get(), cfg);
 
     CURLcode res = curl_easy_perform(curl.get());
+    record_outcome(cfg, curl.get(), res, deadline);
     if (res != CURLE_OK) {
-        error_out = "FTP List Failed: " + std::string(curl_easy_strerror(res));
-        return "";
+        error_out = "FTP List Failed: " + transfer_error(res, deadline);
+        return day_files;
     }
 
     // Log the raw directory listing for triage
-    write_log(cfg.log_file, std::string("FTP raw listing for /CFDisk/mindata/:\n") + file_list);
+    write_log(cfg.log_file, std::string("FTP raw listing for ") + FTP_DATA_DIR + ":\n" + file_list);
 
-    std::vector<std::string> day_files;
     std::stringstream ss(file_list);
     std::string filename;
     while (std::getline(ss, filename)) {
@@ -140,49 +242,18 @@ std::string discover_latest_file(const Config& cfg, std::string& error_out) {
 
     if (day_files.empty()) {
         error_out = "No valid 'day' files found in " + url;
-        return "";
+        return day_files;
     }
 
-    // Prefer date-aware comparison. Filenames are expected to contain a date
-    // like dayDDMMYY.dat or dayDDMMYYYY.dat. Parse day, month, year and compare
-    // by (year, month, day) so 15 Feb 2026 (150226) > 31 Jan 2026 (310126).
-    auto parse_date = [](const std::string& s) -> std::tuple<int,int,int> {
-        std::string lower = s;
-        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
-        size_t pos = lower.find("day");
-        if (pos == std::string::npos) return std::tuple<int,int,int>{-1,-1,-1};
-        pos += 3;
-        size_t dot = lower.rfind(".dat");
-        if (dot == std::string::npos || dot <= pos) return std::tuple<int,int,int>{-1,-1,-1};
-        std::string numpart = lower.substr(pos, dot - pos);
-        std::string digits;
-        for (char c : numpart) if (std::isdigit((unsigned char)c)) digits.push_back(c);
-        if (digits.size() == 6) {
-            // DDMMYY
-            int dd = std::stoi(digits.substr(0,2));
-            int mm = std::stoi(digits.substr(2,2));
-            int yy = std::stoi(digits.substr(4,2));
-            int year = 2000 + yy; // assume 2000s
-            return std::tuple<int,int,int>{year, mm, dd};
-        } else if (digits.size() == 8) {
-            // DDMMYYYY
-            int dd = std::stoi(digits.substr(0,2));
-            int mm = std::stoi(digits.substr(2,2));
-            int year = std::stoi(digits.substr(4,4));
-            return std::tuple<int,int,int>{year, mm, dd};
-        }
-        return std::tuple<int,int,int>{-1,-1,-1};
-    };
-
     std::sort(day_files.begin(), day_files.end(), [&](const std::string& a, const std::string& b) {
-        auto da = parse_date(a);
-        auto db = parse_date(b);
-        if (std::get<0>(da) >= 0 && std::get<0>(db) >= 0) {
-            if (da != db) return da < db; // tuple comparison on (year,month,day)
+        int da = parse_day_file_date(a);
+        int db = parse_day_file_date(b);
+        if (da >= 0 && db >= 0) {
+            if (da != db) return da < db;
             return a < b;
         }
-        if (std::get<0>(da) >= 0) return true;  // valid date sorts before invalid
-        if (std::get<0>(db) >= 0) return false;
+        if (da >= 0) return true;  // valid date sorts before invalid
+        if (db >= 0) return false;
         // fallback: case-insensitive lexical
         std::string la = a, lb = b;
         std::transform(la.begin(), la.end(), la.begin(), ::tolower);
@@ -190,23 +261,29 @@ std::string discover_latest_file(const Config& cfg, std::string& error_out) {
         return la < lb;
     });
 
-    std::string latest = day_files.back();
-
     // Log the sorted list with parsed dates for debugging
     for (const auto& f : day_files) {
-        auto d = parse_date(f);
-        if (std::get<0>(d) >= 0) {
+        int d = parse_day_file_date(f);
+        if (d >= 0) {
             write_log(cfg.log_file, std::string("Sorted candidate: ") + f + std::string("  date=") +
-                      std::to_string(std::get<0>(d)) + "-" + std::to_string(std::get<1>(d)) + "-" + std::to_string(std::get<2>(d)));
+                      std::to_string(d / 10000) + "-" + std::to_string(d / 100 % 100) + "-" + std::to_string(d % 100));
         } else {
             write_log(cfg.log_file, std::string("Sorted candidate: ") + f + std::string("  date=(na)"));
         }
     }
 
+    return day_files;
+}
+
+std::string discover_latest_file(const Config& cfg, std::string& error_out, const Deadline& deadline) {
+    std::vector<std::string> day_files = list_day_files(cfg, error_out, deadline);
+    if (day_files.empty()) return "";
+
+    std::string latest = day_files.back();
     write_log(cfg.log_file, std::string("Selected latest file: ") + latest);
     
     // Return full path if needed, or just filename. Python returns just filename and then appends it to path in RETR.
     // Our download_ftp expects the filename to be appended to cfg.ftp_host.
     // However, the directory path is /CFDisk/mindata/
-    return "/CFDisk/mindata/" + latest;
+    return FTP_DATA_DIR + latest;
 }
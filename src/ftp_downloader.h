@@ -1,12 +1,37 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include "config.h"
+#include "host_health.h"
+#include "deadline.h"
+
+// Directory on the controller that holds the dayDDMMYY.dat records
+static const std::string FTP_DATA_DIR = "/CFDisk/mindata/";
+
+// Every transfer below ends by the deadline: its connect and total timeouts are capped at the
+// time left and it is aborted from curl's progress callback once the deadline passes or is
+// cancelled. error_out then reads "deadline exceeded" or "cancelled".
 
 // Download the remote file from FTP to the configured local file (atomic rename on success)
 // Returns true on success, false on failure. On failure an optional message can be set in error_out.
-bool download_ftp(const Config& cfg, const std::string& remote_filename, std::string& error_out);
+bool download_ftp(const Config& cfg, const std::string& remote_filename, std::string& error_out,
+                  const Deadline& deadline = Deadline());
+
+// Same as download_ftp but writes to local_path instead of cfg.local_file
+bool download_ftp_to(const Config& cfg, const std::string& remote_filename, const std::string& local_path,
+                     std::string& error_out, const Deadline& deadline = Deadline());
 
 // Find the correct dayDDMMYY.dat file using FTP server time (not local time)
 // This ensures correct file selection even when device time is wrong
-std::string discover_latest_file(const Config& cfg, std::string& error_out);
+std::string discover_latest_file(const Config& cfg, std::string& error_out, const Deadline& deadline = Deadline());
+
+// List all dayDDMMYY.dat files in FTP_DATA_DIR, sorted oldest to newest (bare filenames)
+std::vector<std::string> list_day_files(const Config& cfg, std::string& error_out,
+                                        const Deadline& deadline = Deadline());
+
+// Retry and circuit breaker state of the FTP controller; every transfer reports its outcome here
+HostHealth& ftp_host_health(const Config& cfg);
+
+// Date encoded in a dayDDMMYY.dat / dayDDMMYYYY.dat filename as YYYYMMDD, or -1 if it has none
+int parse_day_file_date(const std::string& filename);
@@ -0,0 +1,371 @@
+#include "heap_profiler.h"
+#include "memory_monitor.h"
+#include "utils.h"
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <ctime>
+#include <unwind.h>
+#include <dlfcn.h>
+
+namespace {
+
+const int MAX_DEPTH = 12;                       // frames kept per allocation site
+const int SKIP_FRAMES = 3;                      // capture_stack, record_sample, operator new
+const size_t SLOT_COUNT = 4096;                 // live sampled pointers (power of two)
+const size_t MAX_LIVE = SLOT_COUNT * 3 / 4;     // keep probe chains short
+const size_t BUCKET_COUNT = 512;                // distinct allocation sites (power of two)
+const uintptr_t TOMBSTONE = 1;
+
+struct StackBucket {
+    uint32_t hash;
+    int depth;
+    uintptr_t pcs[MAX_DEPTH];
+    unsigned long long alloc_count;
+    unsigned long long alloc_bytes;
+    unsigned long long live_count;
+    unsigned long long live_bytes;
+};
+
+struct LiveSample {
+    size_t size;
+    int bucket;
+};
+
+// All state is static POD or constexpr-constructed, so it is usable before main() and
+// during static destruction, when operator new/delete are already in use.
+std::atomic<bool> g_active(false);
+std::atomic<size_t> g_sample_bytes(0);
+std::atomic<size_t> g_live(0);
+std::atomic<uintptr_t> g_slots[SLOT_COUNT];     // pointer keys, lock-free reads, writes under g_mutex
+LiveSample g_samples[SLOT_COUNT];
+StackBucket g_buckets[BUCKET_COUNT];
+int g_bucket_index[BUCKET_COUNT];               // hash table over g_buckets, 0 = empty, else index + 1
+size_t g_bucket_used = 0;
+unsigned long long g_samples_taken = 0;
+unsigned long long g_dropped = 0;
+std::mutex g_mutex;
+
+__thread long long t_bytes_until_sample;
+__thread uint32_t t_rng;
+__thread bool t_busy;
+
+inline size_t slot_for(uintptr_t key) {
+    return static_cast<size_t>((key >> 3) * 2654435761u) & (SLOT_COUNT - 1);
+}
+
+// Exponentially distributed distance to the next sample, so every byte has the same chance
+long long next_interval() {
+    t_rng ^= t_rng << 13;
+    t_rng ^= t_rng >> 17;
+    t_rng ^= t_rng << 5;
+    double u = ((t_rng >> 8) + 1) / 16777217.0;
+    double interval = -std::log(u) * static_cast<double>(g_sample_bytes.load(std::memory_order_relaxed));
+    return interval < 1.0 ? 1 : static_cast<long long>(interval);
+}
+
+struct UnwindState {
+    uintptr_t* pcs;
+    int skip;
+    int depth;
+};
+
+_Unwind_Reason_Code unwind_frame(struct _Unwind_Context* ctx, void* arg) {
+    UnwindState* state = static_cast<UnwindState*>(arg);
+    uintptr_t ip = static_cast<uintptr_t>(_Unwind_GetIP(ctx));
+    if (ip == 0) return _URC_END_OF_STACK;
+    if (state->skip > 0) {
+        state->skip--;
+        return _URC_NO_REASON;
+    }
+    state->pcs[state->depth++] = ip;
+    return state->depth >= MAX_DEPTH ? _URC_END_OF_STACK : _URC_NO_REASON;
+}
+
+__attribute__((noinline)) int capture_stack(uintptr_t* pcs) {
+    UnwindState state = { pcs, SKIP_FRAMES, 0 };
+    _Unwind_Backtrace(unwind_frame, &state);
+    return state.depth;
+}
+
+// Find or add the bucket for a stack; -1 when the site table is full. Caller holds g_mutex.
+int bucket_for(const uintptr_t* pcs, int depth) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < depth; ++i) {
+        hash = (hash ^ static_cast<uint32_t>(pcs[i])) * 16777619u;
+    }
+    for (size_t n = 0, i = hash & (BUCKET_COUNT - 1); n < BUCKET_COUNT; ++n, i = (i + 1) & (BUCKET_COUNT - 1)) {
+        if (g_bucket_index[i] == 0) {
+            if (g_bucket_used == BUCKET_COUNT) return -1;
+            StackBucket& b = g_buckets[g_bucket_used];
+            b.hash = hash;
+            b.depth = depth;
+            std::copy(pcs, pcs + depth, b.pcs);
+            g_bucket_index[i] = static_cast<int>(++g_bucket_used);
+            return static_cast<int>(g_bucket_used - 1);
+        }
+        const StackBucket& b = g_buckets[g_bucket_index[i] - 1];
+        if (b.hash == hash && b.depth == depth && std::equal(pcs, pcs + depth, b.pcs)) {
+            return g_bucket_index[i] - 1;
+        }
+    }
+    return -1;
+}
+
+__attribute__((noinline)) void record_sample(void* ptr, size_t size) {
+    if (t_rng == 0) {
+        // First allocation on this thread since profiling started: only pick a sampling point
+        t_rng = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&t_rng)) ^ static_cast<uint32_t>(time(nullptr)) ^ 0x9e3779b9u;
+        if (t_rng == 0) t_rng = 1;
+        t_bytes_until_sample = next_interval();
+        return;
+    }
+    if (t_busy) return;
+    t_busy = true;
+    t_bytes_until_sample = next_interval();
+
+    uintptr_t pcs[MAX_DEPTH];
+    int depth = capture_stack(pcs);
+    uintptr_t key = reinterpret_cast<uintptr_t>(ptr);
+
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        g_samples_taken++;
+        int bucket = bucket_for(pcs, depth);
+        if (bucket < 0 || g_live.load(std::memory_order_relaxed) >= MAX_LIVE) {
+            g_dropped++;
+        } else {
+            size_t i = slot_for(key);
+            while (g_slots[i].load(std::memory_order_relaxed) > TOMBSTONE) i = (i + 1) & (SLOT_COUNT - 1);
+            g_samples[i].size = size;
+            g_samples[i].bucket = bucket;
+            g_live.fetch_add(1, std::memory_order_relaxed);
+            g_slots[i].store(key, std::memory_order_release);
+
+            StackBucket& b = g_buckets[bucket];
+            b.alloc_count++;
+            b.alloc_bytes += size;
+            b.live_count++;
+            b.live_bytes += size;
+        }
+    }
+    t_busy = false;
+}
+
+__attribute__((noinline)) void forget_sample(void* ptr) {
+    uintptr_t key = reinterpret_cast<uintptr_t>(ptr);
+    size_t i = slot_for(key);
+    for (size_t n = 0; n < SLOT_COUNT; ++n, i = (i + 1) & (SLOT_COUNT - 1)) {
+        uintptr_t v = g_slots[i].load(std::memory_order_acquire);
+        if (v == 0) return;             // not sampled
+        if (v != key) continue;
+
+        std::lock_guard<std::mutex> lock(g_mutex);
+        if (g_slots[i].load(std::memory_order_relaxed) != key) return;
+        StackBucket& b = g_buckets[g_samples[i].bucket];
+        b.live_count--;
+        b.live_bytes -= g_samples[i].size;
+        g_slots[i].store(TOMBSTONE, std::memory_order_release);
+        g_live.fetch_sub(1, std::memory_order_relaxed);
+
+        // A tombstone directly before an empty slot ends no live probe chain, so it can be
+        // emptied again; walking backwards keeps chains short without a rehash
+        if (g_slots[(i + 1) & (SLOT_COUNT - 1)].load(std::memory_order_relaxed) == 0) {
+            while (g_slots[i].load(std::memory_order_relaxed) == TOMBSTONE) {
+                g_slots[i].store(0, std::memory_order_release);
+                i = (i - 1) & (SLOT_COUNT - 1);
+            }
+        }
+        return;
+    }
+}
+
+__attribute__((always_inline)) inline void* profiled_alloc(size_t size) {
+    void* ptr = std::malloc(size ? size : 1);
+    if (ptr && g_active.load(std::memory_order_relaxed)) {
+        t_bytes_until_sample -= static_cast<long long>(size);
+        if (t_bytes_until_sample <= 0) record_sample(ptr, size);
+    }
+    return ptr;
+}
+
+__attribute__((always_inline)) inline void* profiled_alloc_or_throw(size_t size) {
+    void* ptr;
+    while ((ptr = profiled_alloc(size)) == nullptr) {
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+    return ptr;
+}
+
+inline void profiled_free(void* ptr) {
+    if (ptr && g_live.load(std::memory_order_relaxed) > 0) forget_sample(ptr);
+    std::free(ptr);
+}
+
+// Reported sizes are scaled up the way pprof unsamples heap_v2 profiles: an allocation of
+// size s is sampled with probability 1 - exp(-s / interval)
+double unsample_scale(unsigned long long count, unsigned long long bytes, size_t interval) {
+    if (count == 0 || interval == 0) return 1.0;
+    double avg = static_cast<double>(bytes) / static_cast<double>(count);
+    return 1.0 / (1.0 - std::exp(-avg / static_cast<double>(interval)));
+}
+
+std::vector<StackBucket> snapshot_buckets() {
+    std::vector<StackBucket> buckets;
+    buckets.reserve(BUCKET_COUNT);      // allocate before locking: operator new may need g_mutex
+    std::lock_guard<std::mutex> lock(g_mutex);
+    buckets.insert(buckets.end(), g_buckets, g_buckets + g_bucket_used);
+    return buckets;
+}
+
+std::string describe_frame(uintptr_t pc) {
+    std::ostringstream oss;
+    Dl_info info;
+    bool found = dladdr(reinterpret_cast<void*>(pc), &info) != 0;
+    if (found && info.dli_sname) {
+        oss << info.dli_sname << "+0x" << std::hex << (pc - reinterpret_cast<uintptr_t>(info.dli_saddr));
+    } else if (found && info.dli_fname) {
+        std::string module = info.dli_fname;
+        size_t slash = module.rfind('/');
+        if (slash != std::string::npos) module = module.substr(slash + 1);
+        oss << module << "+0x" << std::hex << (pc - reinterpret_cast<uintptr_t>(info.dli_fbase));
+    } else {
+        oss << "0x" << std::hex << pc;
+    }
+    return oss.str();
+}
+
+} // namespace
+
+// ============================================================================
+// Replaced global allocation functions
+// ============================================================================
+
+void* operator new(size_t size) { return profiled_alloc_or_throw(size); }
+void* operator new[](size_t size) { return profiled_alloc_or_throw(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return profiled_alloc(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return profiled_alloc(size); }
+void operator delete(void* ptr) noexcept { profiled_free(ptr); }
+void operator delete[](void* ptr) noexcept { profiled_free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { profiled_free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { profiled_free(ptr); }
+
+// ============================================================================
+// HeapProfiler
+// ============================================================================
+
+void HeapProfiler::start(size_t sample_bytes) {
+    g_sample_bytes.store(sample_bytes ? sample_bytes : 1, std::memory_order_relaxed);
+    g_active.store(true, std::memory_order_release);
+}
+
+void HeapProfiler::stop() {
+    g_active.store(false, std::memory_order_release);
+}
+
+bool HeapProfiler::running() {
+    return g_active.load(std::memory_order_acquire);
+}
+
+bool HeapProfiler::write_pprof(const std::string& path, std::string& error_out) {
+    std::vector<StackBucket> buckets = snapshot_buckets();
+    size_t interval = g_sample_bytes.load(std::memory_order_relaxed);
+
+    unsigned long long live_count = 0, live_bytes = 0, alloc_count = 0, alloc_bytes = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        live_count += buckets[i].live_count;
+        live_bytes += buckets[i].live_bytes;
+        alloc_count += buckets[i].alloc_count;
+        alloc_bytes += buckets[i].alloc_bytes;
+    }
+
+    std::string tmp_path = path + ".tmp";
+    std::ofstream out(tmp_path.c_str(), std::ios::trunc);
+    if (!out) {
+        error_out = "Cannot write heap profile " + tmp_path;
+        return false;
+    }
+    // Counts are raw samples; pprof scales them using the heap_v2 sampling interval
+    out << "heap profile: " << live_count << ": " << live_bytes << " [" << alloc_count << ": " << alloc_bytes
+        << "] @ heap_v2/" << interval << "\n";
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        const StackBucket& b = buckets[i];
+        out << b.live_count << ": " << b.live_bytes << " [" << b.alloc_count << ": " << b.alloc_bytes << "] @";
+        for (int d = 0; d < b.depth; ++d) out << " 0x" << std::hex << b.pcs[d] << std::dec;
+        out << "\n";
+    }
+    // Module layout lets pprof symbolize addresses against unstripped copies of the binaries
+    out << "\nMAPPED_LIBRARIES:\n";
+    std::ifstream maps("/proc/self/maps");
+    out << maps.rdbuf();
+    out.close();
+
+    if (!out || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        error_out = "Cannot write heap profile " + path;
+        return false;
+    }
+    return true;
+}
+
+void HeapProfiler::log_report(const std::string& log_file, const std::string& pprof_path, int top_n) {
+    std::vector<StackBucket> buckets = snapshot_buckets();
+    size_t interval = g_sample_bytes.load(std::memory_order_relaxed);
+    unsigned long long samples = 0, dropped = 0;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        samples = g_samples_taken;
+        dropped = g_dropped;
+    }
+
+    double est_live_total = 0;
+    std::vector<std::pair<double, size_t> > ranked;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        const StackBucket& b = buckets[i];
+        if (b.live_count == 0) continue;
+        double est = b.live_bytes * unsample_scale(b.live_count, b.live_bytes, interval);
+        est_live_total += est;
+        ranked.push_back(std::make_pair(est, i));
+    }
+    std::sort(ranked.begin(), ranked.end(), std::greater<std::pair<double, size_t> >());
+
+    std::ostringstream msg;
+    msg << "Heap profile: ~" << MemoryMonitor::formatBytes(static_cast<long long>(est_live_total))
+        << " live in sampled sites (" << g_live.load(std::memory_order_relaxed) << " live samples, "
+        << samples << " taken, " << dropped << " dropped, 1 per " << MemoryMonitor::formatBytes(interval)
+        << ", " << buckets.size() << " sites)";
+    write_log(log_file, msg.str());
+
+    for (size_t r = 0; r < ranked.size() && static_cast<int>(r) < top_n; ++r) {
+        const StackBucket& b = buckets[ranked[r].second];
+        double scale = unsample_scale(b.live_count, b.live_bytes, interval);
+        double alloc_scale = unsample_scale(b.alloc_count, b.alloc_bytes, interval);
+        std::ostringstream site;
+        site << "  #" << (r + 1) << " ~" << MemoryMonitor::formatBytes(static_cast<long long>(ranked[r].first))
+             << " live in ~" << static_cast<long long>(b.live_count * scale) << " objects, ~"
+             << MemoryMonitor::formatBytes(static_cast<long long>(b.alloc_bytes * alloc_scale)) << " allocated:";
+        for (int d = 0; d < b.depth; ++d) site << (d ? " <- " : " ") << describe_frame(b.pcs[d]);
+        write_log(log_file, site.str());
+    }
+
+    std::string error;
+    if (pprof_path.empty()) return;
+    if (HeapProfiler::write_pprof(pprof_path, error)) {
+        write_log(log_file, "Heap profile written to " + pprof_path);
+    } else {
+        std::cerr << error << std::endl;
+        write_log(log_file, "Heap profile error: " + error);
+    }
+}
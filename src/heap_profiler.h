@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+// Sampling heap profiler built into the binary (global operator new/delete are replaced).
+//
+// While stopped the only cost is one relaxed atomic load per allocation and per free. While
+// running, each thread counts allocated bytes down to an exponentially distributed sampling
+// point (mean: the sampling interval); the allocation that crosses it records a shallow
+// backtrace into a fixed table of allocation sites and a bounded table of live sampled
+// pointers. Nothing in the sampling path allocates, so the profiler cannot perturb the heap
+// it measures. Reports estimate real sizes from the samples the same way pprof does.
+class HeapProfiler {
+public:
+    // Start sampling about one allocation per sample_bytes allocated. Live samples of an
+    // earlier run are kept, so start/stop can be repeated.
+    static void start(size_t sample_bytes);
+    static void stop();
+    static bool running();
+
+    // Write a pprof-compatible (legacy heap_v2 text format) profile of the sampled allocations
+    // to path; view it with `pprof --text <binary> <path>`
+    static bool write_pprof(const std::string& path, std::string& error_out);
+
+    // Log the top_n allocation sites by estimated live bytes and write the pprof file
+    static void log_report(const std::string& log_file, const std::string& pprof_path, int top_n = 10);
+};
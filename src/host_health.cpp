@@ -0,0 +1,266 @@
+#include "host_health.h"
+#include "utils.h"
+#include <map>
+#include <memory>
+#include <thread>
+#include <condition_variable>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+namespace {
+
+const char* state_name(HostHealth::State s) {
+    switch (s) {
+    case HostHealth::CLOSED: return "closed";
+    case HostHealth::OPEN: return "open";
+    case HostHealth::HALF_OPEN: return "half-open";
+    }
+    return "?";
+}
+
+long long ms_until(std::chrono::steady_clock::time_point t) {
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(t - std::chrono::steady_clock::now()).count();
+    return ms > 0 ? ms : 0;
+}
+
+std::mutex registry_mtx;
+std::map<std::string, std::unique_ptr<HostHealth> > registry;
+
+// One getaddrinfo call shared between the waiting caller and the thread running it
+struct Lookup {
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool done;
+    bool abandoned;             // the caller gave up; the thread frees the result
+    int rc;
+    struct addrinfo* addrs;
+
+    Lookup() : done(false), abandoned(false), rc(0), addrs(nullptr) {}
+};
+
+// getaddrinfo has no timeout of its own and an unreachable DNS server can hold it for tens of
+// seconds, so it runs on a detached thread and the caller waits at most timeout_ms
+bool resolve_within(const std::string& host, int port, int timeout_ms, struct addrinfo*& addrs_out,
+                    std::string& error_out) {
+    std::shared_ptr<Lookup> lookup(new Lookup());
+    std::string service = std::to_string(port);
+    std::thread([lookup, host, service]() {
+        struct addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo* addrs = nullptr;
+        int rc = getaddrinfo(host.c_str(), service.c_str(), &hints, &addrs);
+
+        std::lock_guard<std::mutex> lock(lookup->mtx);
+        if (lookup->abandoned) {
+            if (rc == 0) freeaddrinfo(addrs);
+            return;
+        }
+        lookup->rc = rc;
+        lookup->addrs = addrs;
+        lookup->done = true;
+        lookup->cv.notify_one();
+    }).detach();
+
+    std::unique_lock<std::mutex> lock(lookup->mtx);
+    if (!lookup->cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&lookup] { return lookup->done; })) {
+        lookup->abandoned = true;
+        error_out = "resolve timed out";
+        return false;
+    }
+    if (lookup->rc != 0) {
+        error_out = "resolve failed: " + std::string(gai_strerror(lookup->rc));
+        return false;
+    }
+    addrs_out = lookup->addrs;
+    return true;
+}
+
+} // namespace
+
+// ============================================================================
+// HostHealth
+// ============================================================================
+
+HostHealth::HostHealth(const std::string& name, const std::string& host, int port)
+    : name(name), host(host), port(port), current(CLOSED), consecutive_failures(0), probing(false), total_failures(0),
+      next_attempt(std::chrono::steady_clock::now()),
+      rng(static_cast<unsigned>(std::chrono::steady_clock::now().time_since_epoch().count())) {}
+
+// Exponential backoff with "equal jitter": half the step is fixed, half is random, so retries
+// from several gateways that lost the same broker do not line up
+long long HostHealth::backoff_ms(const Config& cfg, int failures) {
+    long long cap = static_cast<long long>(cfg.retry_interval) * 1000;
+    long long step = static_cast<long long>(cfg.retry_backoff_base) * 1000;
+    for (int i = 1; i < failures && step < cap; ++i) step *= 2;
+    step = std::min(step, cap);
+    std::uniform_int_distribution<long long> jitter(0, step / 2);
+    return step - step / 2 + jitter(rng);
+}
+
+bool HostHealth::allow_attempt(const Config& cfg) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (current != OPEN) return true;
+        if (probing || ms_until(next_attempt) > 0) return false;
+        probing = true;
+    }
+
+    // Probe without holding the lock; the flag keeps other callers of the same host out meanwhile
+    std::string error;
+    bool up = tcp_probe(host, port, cfg.connect_timeout * 1000, error);
+
+    std::lock_guard<std::mutex> lock(mtx);
+    probing = false;
+    if (!up) {
+        last_error = error;
+        next_attempt = std::chrono::steady_clock::now() + std::chrono::seconds(cfg.circuit_probe_interval);
+        return false;
+    }
+    current = HALF_OPEN;
+    write_log(cfg.log_file, "Host health: " + name + " " + host + ":" + std::to_string(port) +
+              " answers again, circuit half-open");
+    return true;
+}
+
+void HostHealth::record_success(const Config& cfg) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (current != CLOSED || consecutive_failures > 0) {
+        write_log(cfg.log_file, "Host health: " + name + " " + host + ":" + std::to_string(port) +
+                  " recovered after " + std::to_string(consecutive_failures) + " failure(s), circuit closed");
+    }
+    current = CLOSED;
+    consecutive_failures = 0;
+    next_attempt = std::chrono::steady_clock::now();
+}
+
+void HostHealth::record_failure(const Config& cfg, const std::string& error) {
+    std::lock_guard<std::mutex> lock(mtx);
+    consecutive_failures++;
+    total_failures++;
+    last_error = error;
+
+    if (current == HALF_OPEN) {
+        // The host takes a TCP connect but still fails the real one: keep backing off rather
+        // than letting every successful probe through to another full attempt
+        long long delay_ms = std::max(static_cast<long long>(cfg.circuit_probe_interval) * 1000,
+                                      backoff_ms(cfg, consecutive_failures));
+        write_log(cfg.log_file, "Host health: " + name + " " + host + ":" + std::to_string(port) +
+                  " still failing after probe, circuit open, next probe in " + std::to_string((delay_ms + 999) / 1000) + " s");
+        current = OPEN;
+        next_attempt = std::chrono::steady_clock::now() + std::chrono::milliseconds(delay_ms);
+    } else if (consecutive_failures >= cfg.circuit_failure_threshold) {
+        if (current != OPEN) {
+            write_log(cfg.log_file, "Host health: " + name + " " + host + ":" + std::to_string(port) +
+                      " circuit open after " + std::to_string(consecutive_failures) +
+                      " failure(s), probing every " + std::to_string(cfg.circuit_probe_interval) + " s");
+        }
+        current = OPEN;
+        next_attempt = std::chrono::steady_clock::now() + std::chrono::seconds(cfg.circuit_probe_interval);
+    } else {
+        next_attempt = std::chrono::steady_clock::now() + std::chrono::milliseconds(backoff_ms(cfg, consecutive_failures));
+    }
+}
+
+long long HostHealth::retry_delay_ms() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return ms_until(next_attempt);
+}
+
+HostHealth::State HostHealth::state() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return current;
+}
+
+std::string HostHealth::summary() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    std::ostringstream oss;
+    oss << name << " " << host << ":" << port << " " << state_name(current);
+    if (consecutive_failures > 0) {
+        oss << " (" << consecutive_failures << " failures, "
+            << (current == OPEN ? "probe" : "retry") << " in " << (ms_until(next_attempt) + 999) / 1000 << " s";
+        if (!last_error.empty()) oss << ", last: " << last_error;
+        oss << ")";
+    } else if (total_failures > 0) {
+        oss << " (" << total_failures << " failures total)";
+    }
+    return oss.str();
+}
+
+// ============================================================================
+// Registry and helpers
+// ============================================================================
+
+HostHealth& host_health(const std::string& name, const std::string& host, int port) {
+    std::string key = name + " " + host + ":" + std::to_string(port);
+    std::lock_guard<std::mutex> lock(registry_mtx);
+    std::unique_ptr<HostHealth>& entry = registry[key];
+    if (!entry) entry.reset(new HostHealth(name, host, port));
+    return *entry;
+}
+
+std::string host_health_summary() {
+    std::lock_guard<std::mutex> lock(registry_mtx);
+    std::ostringstream oss;
+    for (std::map<std::string, std::unique_ptr<HostHealth> >::const_iterator it = registry.begin(); it != registry.end(); ++it) {
+        if (it != registry.begin()) oss << " | ";
+        oss << it->second->summary();
+    }
+    return oss.str();
+}
+
+void split_host_port(const std::string& address, int default_port, std::string& host, int& port) {
+    host = address;
+    port = default_port;
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos || colon + 1 == address.size()) return;
+    std::string port_str = address.substr(colon + 1);
+    if (!std::all_of(port_str.begin(), port_str.end(), ::isdigit)) return;
+    host = address.substr(0, colon);
+    port = std::atoi(port_str.c_str());
+}
+
+bool tcp_probe(const std::string& host, int port, int timeout_ms, std::string& error_out) {
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    struct addrinfo* addrs = nullptr;
+    if (!resolve_within(host, port, timeout_ms, addrs, error_out)) return false;
+    std::unique_ptr<struct addrinfo, void (*)(struct addrinfo*)> addrs_guard(addrs, freeaddrinfo);
+    // The connect gets what the lookup left of the timeout
+    timeout_ms = std::max(1, timeout_ms - static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                              std::chrono::steady_clock::now() - started).count()));
+
+    error_out = "no address";
+    for (struct addrinfo* ai = addrs; ai; ai = ai->ai_next) {
+        int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+        int err = 0;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            err = errno;
+            if (err == EINPROGRESS) {
+                struct pollfd pfd = { fd, POLLOUT, 0 };
+                int ready = poll(&pfd, 1, timeout_ms);
+                socklen_t len = sizeof(err);
+                if (ready == 1) {
+                    getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                } else {
+                    err = ETIMEDOUT;
+                }
+            }
+        }
+        close(fd);
+        if (err == 0) return true;
+        error_out = err == ETIMEDOUT ? "connect timed out" : std::string(strerror(err));
+    }
+    return false;
+}
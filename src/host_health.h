@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <random>
+#include <chrono>
+#include "config.h"
+
+// Retry state for one remote host (the FTP controller or the MQTT broker).
+//
+// closed:    attempts are allowed; each failure schedules the next attempt after an
+//            exponential backoff with jitter (RETRY_BACKOFF_BASE doubling up to RETRY_INTERVAL).
+// open:      after CIRCUIT_FAILURE_THRESHOLD consecutive failures real attempts stop; every
+//            CIRCUIT_PROBE_INTERVAL seconds a bare TCP connect checks whether the host is back.
+// half-open: a probe succeeded; the next real attempt closes the circuit or opens it again, in
+//            which case the next probe keeps backing off (up to RETRY_INTERVAL).
+// Only failures to reach the host count; errors from a host that answered (login denied, missing
+// file, TLS) are reported with record_success() and retried by the caller on its own schedule.
+class HostHealth {
+public:
+    enum State { CLOSED, OPEN, HALF_OPEN };
+
+    HostHealth(const std::string& name, const std::string& host, int port);
+
+    // True if a real attempt may be made now. While open this runs the TCP probe when due; the
+    // live, alarm and backfill publishers share the broker's entry, so only one caller probes
+    // and the others are refused until it is done.
+    bool allow_attempt(const Config& cfg);
+    // The host answered, whether or not the attempt then succeeded
+    void record_success(const Config& cfg);
+    // The host could not be reached (resolve, connect or connect timeout)
+    void record_failure(const Config& cfg, const std::string& error);
+
+    // Milliseconds until the next attempt (closed) or probe (open) is due, 0 if due now
+    long long retry_delay_ms() const;
+
+    State state() const;
+    // e.g. "FTP 10.1.10.132:21 open (7 failures, probe in 3 s)"
+    std::string summary() const;
+
+private:
+    long long backoff_ms(const Config& cfg, int failures);
+
+    const std::string name;
+    const std::string host;
+    const int port;
+
+    mutable std::mutex mtx;
+    State current;
+    int consecutive_failures;
+    bool probing;               // a caller is running the TCP probe; others wait for its result
+    unsigned long long total_failures;
+    std::string last_error;
+    std::chrono::steady_clock::time_point next_attempt;
+    std::minstd_rand rng;
+};
+
+// Shared state for a host, created on first use; references stay valid for the process lifetime
+HostHealth& host_health(const std::string& name, const std::string& host, int port);
+
+// One line with the state of every host seen so far
+std::string host_health_summary();
+
+// Resolve host and open a TCP connection to it, then close it again, giving up after timeout_ms
+// (the name lookup included)
+bool tcp_probe(const std::string& host, int port, int timeout_ms, std::string& error_out);
+
+// Split "host" or "host:port" (as in FTP_HOST) into its parts
+void split_host_port(const std::string& address, int default_port, std::string& host, int& port);
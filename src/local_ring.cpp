@@ -0,0 +1,401 @@
+#include "local_ring.h"
+#include "utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+const char RING_MAGIC[4] = {'M', 'M', 'R', '1'};
+const uint32_t RING_LAYOUT = 1;
+const size_t HEADER_BYTES = 64;
+
+struct RingHeader {
+    char magic[4];
+    uint32_t layout;
+    uint32_t slot_count;
+    uint32_t slot_bytes;
+    uint32_t writer_pid;
+};
+
+struct SlotHeader {
+    uint32_t version;           // odd while the writer is filling the slot
+    uint32_t len;
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t number;
+    int64_t written_us;
+};
+
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_DONTWAIT | MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = MSG_DONTWAIT;
+#endif
+
+size_t ring_bytes(uint32_t slot_count, uint32_t slot_bytes) {
+    return HEADER_BYTES + static_cast<size_t>(slot_count) * slot_bytes;
+}
+
+const SlotHeader* slot_at(const uint8_t* base, uint32_t slot_count, uint32_t slot_bytes, uint64_t number) {
+    return reinterpret_cast<const SlotHeader*>(base + HEADER_BYTES + (number % slot_count) * slot_bytes);
+}
+
+// Record number held by a slot, read under its seqlock; false while the slot is being written
+bool read_number(const SlotHeader* s, uint64_t& number) {
+    uint32_t v1 = __atomic_load_n(&s->version, __ATOMIC_ACQUIRE);
+    if (v1 & 1) return false;
+    number = s->number;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&s->version, __ATOMIC_RELAXED) == v1;
+}
+
+bool header_matches(const RingHeader* h, uint32_t slot_count, uint32_t slot_bytes) {
+    return std::memcmp(h->magic, RING_MAGIC, sizeof(RING_MAGIC)) == 0 && h->layout == RING_LAYOUT &&
+           h->slot_count == slot_count && h->slot_bytes == slot_bytes;
+}
+
+std::string notify_path(const std::string& ring_path) {
+    return ring_path + ".sock";
+}
+
+bool fill_sockaddr(const std::string& path, struct sockaddr_un& addr) {
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) return false;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+}
+
+} // namespace
+
+int64_t local_ring_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+// ============================================================================
+// LocalRing (writer)
+// ============================================================================
+
+LocalRing::LocalRing()
+    : base(nullptr), size(0), slot_count(0), slot_bytes(0), next_number(1), dropped(0), listen_fd(-1) {}
+
+LocalRing::~LocalRing() {
+    close();
+}
+
+void LocalRing::close() {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (size_t i = 0; i < subscribers.size(); ++i) ::close(subscribers[i]);
+    subscribers.clear();
+    if (listen_fd >= 0) {
+        ::close(listen_fd);
+        listen_fd = -1;
+        unlink(notify_path(path).c_str());
+    }
+    if (base) munmap(base, size);
+    base = nullptr;
+}
+
+bool LocalRing::open(const Config& cfg) {
+    close();
+    std::lock_guard<std::mutex> lock(mtx);
+
+    path = cfg.local_ring_path;
+    log_file = cfg.log_file;
+    slot_count = static_cast<uint32_t>(cfg.local_ring_slots);
+    slot_bytes = (static_cast<uint32_t>(cfg.local_ring_slot_bytes) + 63) & ~63u;
+    size = ring_bytes(slot_count, slot_bytes);
+    if (path.empty()) return false;
+
+    // Continue an existing ring with the same layout; otherwise build a new file and rename it
+    // over the old one, so readers that still map the old file never see it change size
+    int fd = ::open(path.c_str(), O_RDWR);
+    struct stat st;
+    bool reuse = false;
+    if (fd >= 0 && fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == size) {
+        RingHeader h;
+        reuse = pread(fd, &h, sizeof(h), 0) == sizeof(h) && header_matches(&h, slot_count, slot_bytes);
+    }
+    if (!reuse) {
+        if (fd >= 0) ::close(fd);
+        std::string tmp = path + ".tmp";
+        fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        RingHeader h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, RING_MAGIC, sizeof(RING_MAGIC));
+        h.layout = RING_LAYOUT;
+        h.slot_count = slot_count;
+        h.slot_bytes = slot_bytes;
+        if (fd < 0 || ftruncate(fd, static_cast<off_t>(size)) != 0 || pwrite(fd, &h, sizeof(h), 0) != sizeof(h) ||
+            std::rename(tmp.c_str(), path.c_str()) != 0) {
+            write_log(log_file, "Local ring: Cannot create " + path + ": " + std::strerror(errno));
+            if (fd >= 0) ::close(fd);
+            std::remove(tmp.c_str());
+            return false;
+        }
+    }
+
+    void* m = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        write_log(log_file, "Local ring: Cannot map " + path + ": " + std::strerror(errno));
+        return false;
+    }
+    base = static_cast<uint8_t*>(m);
+    reinterpret_cast<RingHeader*>(base)->writer_pid = static_cast<uint32_t>(getpid());
+
+    // Number on from the newest record; a slot left odd by a crashed writer is marked empty
+    next_number = 1;
+    for (uint32_t i = 0; i < slot_count; ++i) {
+        SlotHeader* s = reinterpret_cast<SlotHeader*>(base + HEADER_BYTES + static_cast<size_t>(i) * slot_bytes);
+        if (s->version & 1) {
+            s->number = 0;
+            __atomic_store_n(&s->version, s->version + 1, __ATOMIC_RELEASE);
+        }
+        next_number = std::max(next_number, s->number + 1);
+    }
+
+    if (cfg.local_ring_notify) {
+        std::string sock_path = notify_path(path);
+        struct sockaddr_un addr;
+        unlink(sock_path.c_str());
+        listen_fd = fill_sockaddr(sock_path, addr) ? socket(AF_UNIX, SOCK_STREAM, 0) : -1;
+        if (listen_fd < 0 || bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            listen(listen_fd, 8) != 0) {
+            write_log(log_file, "Local ring: Notification socket " + sock_path + " unavailable: " + std::strerror(errno));
+            if (listen_fd >= 0) ::close(listen_fd);
+            listen_fd = -1;
+        } else {
+            // Notifications carry record numbers only; the data itself is in the ring file
+            chmod(sock_path.c_str(), 0666);
+            set_nonblocking(listen_fd);
+        }
+    }
+
+    write_log(log_file, "Local ring: " + std::string(reuse ? "Continued " : "Created ") + path + " (" +
+              std::to_string(slot_count) + " slots of " + std::to_string(slot_bytes) + " bytes, next record " +
+              std::to_string(next_number) + (listen_fd >= 0 ? ", notify socket on" : "") + ")");
+    return true;
+}
+
+bool LocalRing::write(const std::string& record, uint32_t flags) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!base) return false;
+    if (record.size() > slot_bytes - sizeof(SlotHeader)) {
+        if (dropped++ == 0) {
+            write_log(log_file, "Local ring: Record of " + std::to_string(record.size()) + " bytes exceeds " +
+                      "LOCAL_RING_SLOT_BYTES, dropped (logged once)");
+        }
+        return false;
+    }
+
+    uint64_t number = next_number++;
+    SlotHeader* s = const_cast<SlotHeader*>(slot_at(base, slot_count, slot_bytes, number));
+    uint32_t v = s->version;
+    __atomic_store_n(&s->version, v + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    s->len = static_cast<uint32_t>(record.size());
+    s->flags = flags;
+    s->number = number;
+    s->written_us = local_ring_now_us();
+    std::memcpy(reinterpret_cast<uint8_t*>(s) + sizeof(SlotHeader), record.data(), record.size());
+    __atomic_store_n(&s->version, v + 2, __ATOMIC_RELEASE);
+
+    if (listen_fd >= 0) {
+        accept_subscribers();
+        notify(number);
+    }
+    return true;
+}
+
+void LocalRing::accept_subscribers() {
+    for (;;) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) break;
+        set_nonblocking(fd);
+        subscribers.push_back(fd);
+    }
+}
+
+// A subscriber whose socket buffer is full is simply not told; it still has unread
+// notifications and finds every record in the ring
+void LocalRing::notify(uint64_t number) {
+    for (size_t i = 0; i < subscribers.size();) {
+        ssize_t n = send(subscribers[i], &number, sizeof(number), SEND_FLAGS);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            ::close(subscribers[i]);
+            subscribers[i] = subscribers.back();
+            subscribers.pop_back();
+            continue;
+        }
+        ++i;
+    }
+}
+
+std::string LocalRing::summary() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return path + ": " + std::to_string(next_number - 1) + " records, " + std::to_string(dropped) + " dropped, " +
+           std::to_string(subscribers.size()) + " subscribers";
+}
+
+// ============================================================================
+// LocalRingReader
+// ============================================================================
+
+LocalRingReader::LocalRingReader()
+    : base(nullptr), size(0), slot_count(0), slot_bytes(0), inode(0), expected(1), skipped_records(0),
+      notify_fd(-1), next_connect_us(0) {}
+
+LocalRingReader::~LocalRingReader() {
+    close();
+}
+
+void LocalRingReader::close() {
+    if (notify_fd >= 0) ::close(notify_fd);
+    notify_fd = -1;
+    if (base) munmap(const_cast<uint8_t*>(base), size);
+    base = nullptr;
+}
+
+bool LocalRingReader::open(const std::string& ring_path, std::string& error_out) {
+    close();
+    path = ring_path;
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error_out = "cannot open " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    struct stat st;
+    RingHeader h;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < HEADER_BYTES ||
+        pread(fd, &h, sizeof(h), 0) != sizeof(h) || !header_matches(&h, h.slot_count, h.slot_bytes) ||
+        h.slot_count == 0 || h.slot_bytes <= sizeof(SlotHeader) ||
+        static_cast<size_t>(st.st_size) != ring_bytes(h.slot_count, h.slot_bytes)) {
+        error_out = path + " is not a magnet_monitor ring";
+        ::close(fd);
+        return false;
+    }
+    size = static_cast<size_t>(st.st_size);
+    void* m = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        error_out = "cannot map " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    base = static_cast<const uint8_t*>(m);
+    slot_count = h.slot_count;
+    slot_bytes = h.slot_bytes;
+    inode = static_cast<unsigned long>(st.st_ino);
+
+    uint64_t newest = newest_number();
+    expected = newest ? newest : 1;
+    connect_notify();
+    return true;
+}
+
+uint64_t LocalRingReader::newest_number() const {
+    uint64_t newest = 0;
+    for (uint32_t i = 0; i < slot_count; ++i) {
+        uint64_t number = 0;
+        if (read_number(slot_at(base, slot_count, slot_bytes, i), number)) newest = std::max(newest, number);
+    }
+    return newest;
+}
+
+uint64_t LocalRingReader::oldest_number() const {
+    uint64_t newest = newest_number();
+    return newest >= slot_count ? newest - slot_count + 1 : 1;
+}
+
+LocalRingReader::Result LocalRingReader::next(Record& rec) {
+    if (!base) return EMPTY;
+    const SlotHeader* s = slot_at(base, slot_count, slot_bytes, expected);
+    uint32_t v1 = __atomic_load_n(&s->version, __ATOMIC_ACQUIRE);
+    if (v1 & 1) return EMPTY;       // being written; the notification follows
+    uint64_t number = s->number;
+    rec.written_us = s->written_us;
+    rec.flags = s->flags;
+    rec.len = std::min<size_t>(s->len, slot_bytes - sizeof(SlotHeader));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s->version, __ATOMIC_RELAXED) != v1 || number < expected) return EMPTY;
+
+    if (number > expected) {
+        uint64_t oldest = std::max(oldest_number(), expected);
+        skipped_records += oldest - expected;
+        expected = oldest;
+        return LAPPED;
+    }
+
+    rec.number = number;
+    rec.data = reinterpret_cast<const char*>(s) + sizeof(SlotHeader);
+    rec.version = v1;
+    rec.slot = reinterpret_cast<const uint8_t*>(s);
+    expected++;
+    return RECORD;
+}
+
+bool LocalRingReader::confirm(const Record& rec) const {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&reinterpret_cast<const SlotHeader*>(rec.slot)->version, __ATOMIC_RELAXED) == rec.version;
+}
+
+void LocalRingReader::connect_notify() {
+    int64_t now = local_ring_now_us();
+    if (now < next_connect_us) return;
+    next_connect_us = now + 1000000;
+
+    struct sockaddr_un addr;
+    if (!fill_sockaddr(notify_path(path), addr)) return;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return;
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        ::close(fd);
+        return;
+    }
+    set_nonblocking(fd);
+    notify_fd = fd;
+}
+
+void LocalRingReader::wait(int timeout_ms) {
+    if (notify_fd < 0) connect_notify();
+    if (notify_fd < 0) {
+        usleep(static_cast<useconds_t>(std::min(timeout_ms, 10)) * 1000);
+        return;
+    }
+
+    struct pollfd pfd = { notify_fd, POLLIN, 0 };
+    if (poll(&pfd, 1, timeout_ms) <= 0) return;
+    char buf[256];
+    ssize_t n;
+    while ((n = read(notify_fd, buf, sizeof(buf))) > 0) {}
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        // Daemon stopped; reconnect once it is back
+        ::close(notify_fd);
+        notify_fd = -1;
+    }
+}
+
+bool LocalRingReader::replaced() const {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && static_cast<unsigned long>(st.st_ino) != inode;
+}
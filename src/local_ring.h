@@ -0,0 +1,128 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+#include "config.h"
+
+// Shared-memory ring of published rows for processes on the same gateway (HMI, Modbus bridge),
+// so they do not have to subscribe through the remote broker.
+//
+// LOCAL_RING_PATH is a file on tmpfs mapped by the daemon (one writer) and by any number of
+// readers. It holds a 64-byte header followed by LOCAL_RING_SLOTS slots of LOCAL_RING_SLOT_BYTES:
+//
+//   header: u32 magic "MMR1", u32 layout version, u32 slot count, u32 slot bytes, u32 writer pid
+//   slot:   u32 version, u32 length, u32 flags, u32 reserved, u64 record number,
+//           i64 write time (CLOCK_MONOTONIC, us), payload
+//
+// Record n (numbered from 1) lives in slot n % slot count. Each slot is a seqlock: the writer
+// makes `version` odd, writes the slot and makes it even again. A reader takes the version,
+// uses the slot in place and accepts what it read only if the version is unchanged afterwards.
+// Nobody takes a lock, and a reader that falls a whole ring behind skips ahead (never blocks
+// the writer). With LOCAL_RING_NOTIFY the daemon also listens on LOCAL_RING_PATH + ".sock" and
+// sends every connected reader the 8-byte number of each new record, so readers can sleep in
+// poll() instead of spinning.
+
+// Record flags
+const uint32_t LOCAL_RING_BACKFILL = 1;     // row replayed by a backfill, not the latest reading
+
+// Writer side, owned by the daemon. write() may be called from several threads (live publish
+// and backfill); they are serialized among themselves, never with readers.
+class LocalRing {
+public:
+    LocalRing();
+    ~LocalRing();
+
+    // Map (or create) LOCAL_RING_PATH. An existing ring with the same layout is continued so
+    // running readers keep their position across daemon restarts.
+    bool open(const Config& cfg);
+    bool is_open() const { return base != nullptr; }
+    void close();
+
+    // Append one record and notify subscribers. Returns false if the ring is closed or the
+    // record does not fit in a slot (it is then dropped and counted).
+    bool write(const std::string& record, uint32_t flags = 0);
+
+    // e.g. "/tmp/magnet_monitor.ring: 120 records, 0 dropped, 2 subscribers"
+    std::string summary() const;
+
+private:
+    void accept_subscribers();
+    void notify(uint64_t number);
+
+    std::string path;
+    std::string log_file;
+    uint8_t* base;
+    size_t size;
+    uint32_t slot_count;
+    uint32_t slot_bytes;
+
+    mutable std::mutex mtx;
+    uint64_t next_number;
+    uint64_t dropped;
+    int listen_fd;
+    std::vector<int> subscribers;
+};
+
+// Reader side for local consumers. One reader per thread.
+class LocalRingReader {
+public:
+    // A record in place in the shared mapping; data stays readable until the writer reuses the
+    // slot, which confirm() detects
+    struct Record {
+        uint64_t number;
+        int64_t written_us;
+        uint32_t flags;
+        const char* data;
+        size_t len;
+        uint32_t version;
+        const uint8_t* slot;
+    };
+
+    enum Result { RECORD, EMPTY, LAPPED };
+
+    LocalRingReader();
+    ~LocalRingReader();
+
+    // Map an existing ring. Reading starts at the newest record present, if any.
+    bool open(const std::string& path, std::string& error_out);
+    void close();
+
+    // RECORD: rec holds the next record. EMPTY: nothing new yet. LAPPED: the writer overwrote
+    // records this reader had not read; it now continues at the oldest one still present
+    // (skipped() counts the loss).
+    Result next(Record& rec);
+
+    // True if rec was not overwritten while the caller used it. Check before acting on the data.
+    bool confirm(const Record& rec) const;
+
+    // Block until the writer signals a new record or timeout_ms passes. Without a notification
+    // socket (LOCAL_RING_NOTIFY off or daemon not running) this sleeps a few milliseconds.
+    void wait(int timeout_ms);
+
+    // True if the daemon recreated the ring file (different layout); reopen to follow it
+    bool replaced() const;
+
+    uint64_t skipped() const { return skipped_records; }
+
+private:
+    uint64_t newest_number() const;
+    uint64_t oldest_number() const;
+    void connect_notify();
+
+    std::string path;
+    const uint8_t* base;
+    size_t size;
+    uint32_t slot_count;
+    uint32_t slot_bytes;
+    unsigned long inode;
+    uint64_t expected;
+    uint64_t skipped_records;
+    int notify_fd;
+    int64_t next_connect_us;
+};
+
+// Microseconds on the clock used for LocalRingReader::Record::written_us
+int64_t local_ring_now_us();
@@ -2,13 +2,206 @@
 #include <unistd.h>
 #include <curl/curl.h>
 #include <ctime>
+#include <chrono>
+#include <thread>
+#include <cmath>
+#include <vector>
+#include <cctype>
+#include <cstdlib>
+#include <algorithm>
+#include <cstdio>
+#include <sys/resource.h>
 
 #include "config.h"
+#include "config_manager.h"
 #include "utils.h"
 #include "ftp_downloader.h"
 #include "parser.h"
-#include "mqtt_publisher.h"
+#include "output_sink.h"
 #include "memory_monitor.h"
+#include "backfill.h"
+#include "pipeline.h"
+#include "ts_store.h"
+#include "heap_profiler.h"
+#include "scan.h"
+#include "local_ring.h"
+#include "tls_session.h"
+
+// Print min/max/avg per field (and optionally every row) for the stored rows in a time window
+static int run_query(const Config& cfg, const std::string& range, bool print_rows) {
+    size_t sep = range.find("..");
+    long long from = 0, to = 0;
+    if (sep == std::string::npos || !parse_timestamp(range.substr(0, sep), from) ||
+        !parse_timestamp(range.substr(sep + 2), to) || from > to) {
+        std::cerr << "Invalid query range: " << range << " (expected e.g. 2026-02-01..2026-02-08T12:00)" << std::endl;
+        return 1;
+    }
+
+    struct FieldStats { long long count; double min; double max; double sum; };
+    std::vector<FieldStats> stats;
+    long long rows = 0;
+
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    std::string error;
+    bool ok = TimeSeriesStore::query(cfg.ts_store_dir, from, to, [&](long long ts, const float* values, int fields) {
+        rows++;
+        if (stats.size() < static_cast<size_t>(fields)) stats.resize(fields, FieldStats{0, 0, 0, 0});
+        if (print_rows) std::cout << format_timestamp(ts);
+        for (int i = 0; i < fields; ++i) {
+            if (print_rows) std::cout << "," << values[i];
+            if (std::isnan(values[i])) continue;
+            FieldStats& f = stats[i];
+            if (f.count == 0 || values[i] < f.min) f.min = values[i];
+            if (f.count == 0 || values[i] > f.max) f.max = values[i];
+            f.sum += values[i];
+            f.count++;
+        }
+        if (print_rows) std::cout << "\n";
+    }, error);
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+
+    if (!ok) {
+        std::cerr << "Query failed: " << error << std::endl;
+        return 1;
+    }
+    std::cout << "Range " << format_timestamp(from) << " .. " << format_timestamp(to) << ": "
+              << rows << " rows (" << elapsed << " ms)" << std::endl;
+    for (size_t i = 0; i < stats.size(); ++i) {
+        if (stats[i].count == 0) {
+            std::cout << "  field " << i << ": no numeric values" << std::endl;
+        } else {
+            std::cout << "  field " << i << ": n=" << stats[i].count << " min=" << stats[i].min
+                      << " max=" << stats[i].max << " avg=" << stats[i].sum / stats[i].count << std::endl;
+        }
+    }
+    return 0;
+}
+
+// Follow the local shared-memory ring like a co-located consumer would and print each record
+// with the time from the daemon's write to this process seeing it
+static int run_ring_tail(const std::string& path) {
+    LocalRingReader reader;
+    std::string error;
+    if (!reader.open(path, error)) {
+        std::cerr << "Cannot follow local ring: " << error << std::endl;
+        return 1;
+    }
+    std::cout << "Following " << path << " (Ctrl-C to stop)" << std::endl;
+
+    unsigned long long records = 0;
+    int64_t latency_sum = 0, latency_max = 0;
+    int64_t idle_since = local_ring_now_us();
+    while (true) {
+        LocalRingReader::Record rec;
+        LocalRingReader::Result r = reader.next(rec);
+        if (r == LocalRingReader::RECORD) {
+            int64_t latency = local_ring_now_us() - rec.written_us;
+            std::string row(rec.data, rec.len);
+            if (!reader.confirm(rec)) continue;     // overwritten while copying; next() reports the lap
+            records++;
+            latency_sum += latency;
+            latency_max = std::max(latency_max, latency);
+            std::cout << "#" << rec.number << (rec.flags & LOCAL_RING_BACKFILL ? " backfill" : "")
+                      << " +" << latency << " us: " << row << std::endl;
+            if (records % 100 == 0) {
+                std::cout << records << " records, latency avg " << latency_sum / static_cast<int64_t>(records)
+                          << " us max " << latency_max << " us, " << reader.skipped() << " skipped" << std::endl;
+            }
+            idle_since = local_ring_now_us();
+        } else if (r == LocalRingReader::LAPPED) {
+            std::cout << "Reader fell behind, " << reader.skipped() << " records skipped so far" << std::endl;
+        } else {
+            if (local_ring_now_us() - idle_since > 5000000 && reader.replaced()) {
+                if (!reader.open(path, error)) {
+                    std::cerr << "Cannot follow local ring: " << error << std::endl;
+                    return 1;
+                }
+                std::cout << "Ring file was recreated, reopened" << std::endl;
+                idle_since = local_ring_now_us();
+            }
+            reader.wait(1000);
+        }
+    }
+}
+
+// User + system CPU time of the whole process (all threads), microseconds
+static long long process_cpu_us() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+// One line of --tls-bench output; returns the CPU time per connection in microseconds
+static long long print_tls_bench(const char* link, bool cache, int ok, int runs, const TlsStats& stats,
+                                 long long cpu_us, long long wall_us) {
+    long long per_cpu = ok ? cpu_us / ok : 0;
+    std::printf("%-4s session cache %-3s: %d/%d ok, %llu handshakes (%llu resumed), full %.1f ms, resumed %.1f ms, "
+                "CPU %.1f ms/conn, wall %.1f ms/conn\n",
+                link, cache ? "on" : "off", ok, runs, stats.handshakes(), stats.resumed(),
+                stats.average_us(false) / 1000.0, stats.average_us(true) / 1000.0,
+                per_cpu / 1000.0, ok ? wall_us / 1000.0 / ok : 0.0);
+    return per_cpu;
+}
+
+// Connect over each TLS link `runs` times with TLS_SESSION_CACHE off, then on, and compare the
+// handshake time and the CPU used per connection. FTP runs a directory listing per connection,
+// MQTT a connect and disconnect (only when the broker link uses TLS).
+static int run_tls_bench(Config cfg, int runs) {
+    if (cfg.ftp_tls == "off" && !mqtt_tls_enabled(cfg)) {
+        std::cerr << "Neither link uses TLS (FTP_TLS is off, MQTT_TLS is false)" << std::endl;
+        return 1;
+    }
+    long long ftp_cpu[2] = { 0, 0 };
+    long long mqtt_cpu[2] = { 0, 0 };
+    for (int pass = 0; pass < 2; ++pass) {
+        cfg.tls_session_cache = pass == 1;
+
+        if (cfg.ftp_tls != "off") {
+            ftp_tls_stats().reset();
+            std::string error;
+            int ok = 0;
+            long long cpu = process_cpu_us();
+            std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+            for (int i = 0; i < runs; ++i) {
+                if (!list_day_files(cfg, error).empty()) ok++;
+            }
+            long long wall_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - started).count();
+            if (ok < runs) std::cerr << "FTP: " << error << std::endl;
+            ftp_cpu[pass] = print_tls_bench("ftp", cfg.tls_session_cache, ok, runs, ftp_tls_stats(),
+                                            process_cpu_us() - cpu, wall_us);
+        }
+#ifdef ENABLE_MQTT
+        if (mqtt_tls_enabled(cfg)) {
+            mqtt_tls_stats().reset();
+            int ok = 0;
+            long long cpu = process_cpu_us();
+            std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+            for (int i = 0; i < runs; ++i) {
+                MQTTPublisher publisher;
+                if (publisher.connect(cfg)) ok++;
+                publisher.disconnect();
+            }
+            long long wall_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - started).count();
+            mqtt_cpu[pass] = print_tls_bench("mqtt", cfg.tls_session_cache, ok, runs, mqtt_tls_stats(),
+                                             process_cpu_us() - cpu, wall_us);
+        }
+#endif
+    }
+    if (ftp_tls_stats().handshakes() == 0 && mqtt_tls_stats().handshakes() == 0) {
+        std::cout << "No TLS handshakes seen: the server did not offer TLS, or this build has no "
+                     "ENABLE_TLS_SESSION_CACHE / libcurl is not built with OpenSSL" << std::endl;
+    }
+    // A link without handshakes measured plain connects; a saving there would be noise
+    if (ftp_cpu[0] > 0 && ftp_tls_stats().handshakes() > 0)
+        std::printf("ftp  CPU saved per connection: %.0f%%\n", 100.0 * (ftp_cpu[0] - ftp_cpu[1]) / ftp_cpu[0]);
+    if (mqtt_cpu[0] > 0 && mqtt_tls_stats().handshakes() > 0)
+        std::printf("mqtt CPU saved per connection: %.0f%%\n", 100.0 * (mqtt_cpu[0] - mqtt_cpu[1]) / mqtt_cpu[0]);
+    else if (mqtt_cpu[0] > 0)
+        std::cout << "mqtt: no TLS handshakes seen, the broker link did not negotiate TLS" << std::endl;
+    return 0;
+}
 
 struct CurlGlobalRAII {
     CurlGlobalRAII() { curl_global_init(CURL_GLOBAL_ALL); }
@@ -19,22 +212,71 @@ int main(int argc, char* argv[]) {
     std::cout << "Starting C++ Magnet Monitor Service..." << std::endl;
 
     bool run_once = false;
+    std::string backfill_range;
+    std::string query_range;
+    bool query_rows = false;
+    bool ring_tail = false;
+    int tls_bench_runs = 0;
     for (int i = 1; i < argc; ++i) {
         std::string a = argv[i];
         if (a == "--once" || a == "-1") run_once = true;
+        if (a == "--backfill") {
+            if (i + 1 >= argc) {
+                std::cerr << "--backfill requires a FROM..TO date range" << std::endl;
+                return 1;
+            }
+            backfill_range = argv[++i];
+        }
+        if (a == "--query") {
+            if (i + 1 >= argc) {
+                std::cerr << "--query requires a FROM..TO time range" << std::endl;
+                return 1;
+            }
+            query_range = argv[++i];
+        }
+        if (a == "--rows") query_rows = true;
+        if (a == "--ring-tail") ring_tail = true;
+        if (a == "--tls-bench") {
+            tls_bench_runs = (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0])))
+                ? std::atoi(argv[++i]) : 20;
+            if (tls_bench_runs < 1) tls_bench_runs = 1;
+        }
+        if (a == "--scan-bench") {
+            // Needs no configuration: check every scan kernel against the scalar one, then time them
+            size_t megabytes = (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0])))
+                ? static_cast<size_t>(std::atoi(argv[++i])) : 64;
+            std::string error;
+            if (!scan_self_test(error)) {
+                std::cerr << "Scan self-test failed: " << error << std::endl;
+                return 1;
+            }
+            std::cout << "Scan self-test passed" << std::endl;
+            scan_benchmark(megabytes > 0 ? megabytes : 1);
+            return 0;
+        }
         if (a == "--help" || a == "-h") {
-            std::cout << "Usage: magnet_monitor [--once]\n"
-                      << "  --once   Run one download/parse/publish cycle and exit" << std::endl;
+            std::cout << "Usage: magnet_monitor [--once] [--backfill FROM..TO] [--query FROM..TO [--rows]] [--ring-tail]\n"
+                      << "  --once                Run one download/parse/publish cycle and exit\n"
+                      << "  --backfill FROM..TO   Publish every row of the day files in the range and exit\n"
+                      << "                        (dates as DDMMYY or DDMMYYYY, e.g. 010226..150226)\n"
+                      << "  --query FROM..TO      Print min/max/avg per field from the on-device store and exit\n"
+                      << "                        (e.g. 2026-02-01..2026-02-08T12:00); --rows also prints the rows\n"
+                      << "  --ring-tail           Follow LOCAL_RING_PATH as a local consumer and print each row\n"
+                      << "  --scan-bench [MB]     Self-test the row scanning kernels and print their throughput\n"
+                      << "  --tls-bench [N]       Connect N times per TLS link without and with session resumption\n"
+                      << "                        and print handshake time and CPU per connection" << std::endl;
             return 0;
         }
     }
 
-    Config cfg;
     const std::string config_path = "config.json";
-    if (!cfg.load_from_file(config_path)) {
+    ConfigManager config_manager(config_path);
+    if (!config_manager.load()) {
         std::cerr << "Failed to load configuration. Exiting." << std::endl;
         return 1;
     }
+    // Working copy of the active snapshot for startup and housekeeping
+    Config cfg = *config_manager.current();
 
     write_log(cfg.log_file, "Application started");
     write_log(cfg.log_file, "Using FTP server time for file discovery (local device time is not used)");
@@ -59,39 +301,79 @@ int main(int argc, char* argv[]) {
         write_log(cfg.log_file, "Started without login protection (no credentials in config).");
     }
 
+    // Query mode: read the local store only, no network ------------------------------
+    if (!query_range.empty()) {
+        return run_query(cfg, query_range, query_rows);
+    }
+    if (ring_tail) {
+        if (cfg.local_ring_path.empty()) {
+            std::cerr << "LOCAL_RING_PATH is not set in " << config_path << std::endl;
+            return 1;
+        }
+        return run_ring_tail(cfg.local_ring_path);
+    }
+
     // Global initializations
     CurlGlobalRAII curl_raii;
     write_log(cfg.log_file,"curl_global_init");
+
+    if (tls_bench_runs > 0) {
+        return run_tls_bench(cfg, tls_bench_runs);
+    }
+
+    // Backfill mode: replay a historical date range and exit ----------------------------
+    if (!backfill_range.empty()) {
+        int from_date = 0, to_date = 0;
+        if (!parse_backfill_range(backfill_range, from_date, to_date)) {
+            std::cerr << "Invalid backfill range: " << backfill_range << " (expected DDMMYY..DDMMYY)" << std::endl;
+            return 1;
+        }
+        Backfiller backfiller;
+        return backfiller.run(cfg, from_date, to_date) ? 0 : 1;
+    }
     
-    MQTTPublisher mqtt;
-    write_log(cfg.log_file,"MQTT Init");
+    OutputSink sink;
+    write_log(cfg.log_file, "Output sinks: " + output_sink_names());
     
     // Initialize memory leak detector
     MemoryLeakDetector leak_detector;
     write_log(cfg.log_file, "Memory leak detector initialized at " + 
               MemoryMonitor::formatBytes(leak_detector.getBaselineMemory()));
     
-    // Connect MQTT if in daemon mode (for run_once, we connect on demand)
-    if (!run_once) {
-        if (!mqtt.connect(cfg)) {
-            std::cerr << "Initial MQTT connection failed (will retry in loop)." << std::endl;
-            write_log(cfg.log_file, "Initial MQTT connection failed.");
-        } else {
-            write_log(cfg.log_file, "Initial MQTT connection established.");
-        }
-    }
+    // Connect the sinks (MQTT) in the background while the first FTP discovery and download run;
+    // the first publish waits only for whichever of the two finishes last
+    sink.connect_async(cfg);
+    write_log(cfg.log_file, "Initial MQTT connection started in background.");
 
     // Single run (useful for testing) -------------------------------------------------
     if (run_once) {
+        // Same cycle and phase budgets as a daemon cycle
+        Deadline cycle = Deadline::in(cfg.cycle_budget_ms);
         std::string error;
-        std::string remote_filename = discover_latest_file(cfg, error);
+        std::string remote_filename = discover_latest_file(cfg, error, cycle.phase(cfg.discover_budget_ms));
         
         bool success = false;
         if (!remote_filename.empty()) {
             write_log(cfg.log_file, "Single-run: Found latest file " + remote_filename);
-            if (download_ftp(cfg, remote_filename, error)) {
+            if (download_ftp(cfg, remote_filename, error, cycle.phase(cfg.download_budget_ms))) {
+                long long file_ready_ms = ms_since_start();
                 std::string latest_row = get_latest_row(cfg.local_file);
-                success = mqtt.publish(cfg, latest_row);
+                Deadline publish = cycle.phase(cfg.publish_budget_ms);
+                success = sink.publish(cfg, latest_row, true, publish);
+                // publish() also succeeds once the row is queued; the time only counts when the
+                // sinks have confirmed it (MQTT ack, file synced)
+                if (success && !sink.flush(cfg, static_cast<int>(publish.remaining_ms(5000)))) {
+                    std::cerr << "Publish not confirmed by the sinks" << std::endl;
+                    write_log(cfg.log_file, "Single-run: Publish not confirmed by the sinks");
+                    success = false;
+                }
+                if (success) {
+                    long long first_publish_ms = ms_since_start();
+                    std::cout << "Time to first publish: " << first_publish_ms << " ms (file ready after "
+                              << file_ready_ms << " ms)" << std::endl;
+                    write_log(cfg.log_file, "Startup: time to first publish " + std::to_string(first_publish_ms) +
+                              " ms (file ready after " + std::to_string(file_ready_ms) + " ms)");
+                }
             } else {
                 std::cerr << "FTP download failed: " << error << std::endl;
                 write_log(cfg.log_file, "Single-run: FTP download failed: " + error);
@@ -104,54 +386,37 @@ int main(int argc, char* argv[]) {
         return success ? 0 : 1;
     }
 
-    // Daemon mode: loop forever -------------------------------------------------------
-    unsigned long long cycle_count = 0;
+    // Daemon mode: fetch, parse and publish run as pipeline stages ---------------------
+    config_manager.start_watching(cfg.config_watch);
+    Pipeline pipeline(config_manager, sink);
+    pipeline.start();
+    write_log(cfg.log_file, "Pipeline started (queue depth " + std::to_string(cfg.pipeline_queue_depth) + ")");
+
+    // The main thread only does housekeeping once per poll interval
+    unsigned long long tick = 0;
     while (true) {
-        try {
-            cycle_count++;
-            
-            // Check for memory leaks every 10 cycles
-            if (cycle_count % 10 == 0) {
-                bool leak_found = leak_detector.checkAndLog(cfg.log_file, "Cycle " + std::to_string(cycle_count));
-                if (leak_found) {
-                    std::cerr << "⚠️  Memory leak detected! Check log file for details." << std::endl;
+        config_manager.wait_for_change(std::chrono::seconds(cfg.poll_interval));
+        cfg = *config_manager.current();
+        tick++;
+
+        pipeline.log_metrics(cfg);
+
+        // Check for memory leaks every 10 poll intervals
+        if (tick % 10 == 0) {
+            // A profiler started at an earlier check has sampled a full check period by now
+            bool was_profiling = HeapProfiler::running();
+            bool leak_found = leak_detector.checkAndLog(cfg.log_file, "Cycle " + std::to_string(pipeline.cycles()));
+            if (leak_found) {
+                std::cerr << "⚠️  Memory leak detected! Check log file for details." << std::endl;
+                if (cfg.heap_profile_auto && !was_profiling) {
+                    HeapProfiler::start(static_cast<size_t>(cfg.heap_profile_sample_bytes));
+                    write_log(cfg.log_file, "Heap profiler started (1 sample per " +
+                              MemoryMonitor::formatBytes(cfg.heap_profile_sample_bytes) + " allocated)");
                 }
             }
-            
-            std::string error;
-            std::string remote_filename = discover_latest_file(cfg, error);
-            
-            if (!remote_filename.empty()) {
-                write_log(cfg.log_file, "Cycle start: Latest file identified as " + remote_filename);
-                if (download_ftp(cfg, remote_filename, error)) {
-                    std::string latest_row = get_latest_row(cfg.local_file);
-                    if (mqtt.publish(cfg, latest_row)) {
-                        write_log(cfg.log_file, "Cycle success: Data published to MQTT.");
-                    } else {
-                        write_log(cfg.log_file, "Cycle warning: MQTT publish failed.");
-                    }
-                    sleep(cfg.poll_interval);
-                } else {
-                    std::cerr << "FTP download failed: " << error << std::endl;
-                    write_log(cfg.log_file, "Cycle error: FTP failed: " + error);
-                    std::cout << "Retrying FTP in " << cfg.retry_interval << " seconds..." << std::endl;
-                    sleep(cfg.retry_interval);
-                }
-            } else {
-                std::cerr << "File discovery failed: " << error << std::endl;
-                write_log(cfg.log_file, "Cycle error: Discovery failed: " + error);
-                sleep(cfg.retry_interval);
+            if (was_profiling) {
+                HeapProfiler::log_report(cfg.log_file, cfg.heap_profile_file);
             }
-        } catch (const std::exception& e) {
-            std::string err_msg = "Unexpected error in monitor loop: " + std::string(e.what());
-            std::cerr << err_msg << std::endl;
-            write_log(cfg.log_file, err_msg);
-            std::cout << "Restarting loop in 10 seconds..." << std::endl;
-            sleep(10);
-        } catch (...) {
-            std::cerr << "Unknown error in monitor loop." << std::endl;
-            write_log(cfg.log_file, "Unknown error in monitor loop.");
-            sleep(10);
         }
     }
 
@@ -0,0 +1,89 @@
+#include "mqtt_batcher.h"
+#include "utils.h"
+
+MQTTBatcher::MQTTBatcher(OutputSink& publisher, const Config& cfg)
+    : publisher(publisher), cfg(cfg),
+      max_bytes(static_cast<size_t>(cfg.mqtt_batch_max_bytes)),
+      linger(cfg.mqtt_batch_linger_ms),
+      stopping(false), linger_failed(false), rows(0), messages(0) {
+    if (max_bytes > 0) {
+        linger_thread = std::thread(&MQTTBatcher::linger_loop, this);
+    }
+}
+
+MQTTBatcher::~MQTTBatcher() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    cv.notify_all();
+    if (linger_thread.joinable()) linger_thread.join();
+    flush();
+    if (max_bytes > 0 && messages > 0) {
+        write_log(cfg.log_file, "MQTT batching: " + std::to_string(rows) + " rows sent in " +
+                  std::to_string(messages) + " messages");
+    }
+}
+
+bool MQTTBatcher::add(const std::string& row) {
+    if (row.empty()) return true;
+
+    std::lock_guard<std::mutex> lock(mtx);
+    rows++;
+    if (max_bytes == 0) {
+        messages++;
+        return publisher.publish(cfg, row, false);
+    }
+
+    bool ok = !linger_failed;
+    linger_failed = false;
+
+    // Send the current batch first if this row would push it over the size limit
+    if (!buffer.empty() && buffer.size() + 1 + row.size() > max_bytes) {
+        ok = flush_locked() && ok;
+    }
+    if (buffer.empty()) {
+        batch_started = std::chrono::steady_clock::now();
+        cv.notify_all();
+    } else {
+        buffer.push_back('\n');
+    }
+    buffer += row;
+    if (buffer.size() >= max_bytes) {
+        ok = flush_locked() && ok;
+    }
+    return ok;
+}
+
+bool MQTTBatcher::flush() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return flush_locked();
+}
+
+bool MQTTBatcher::flush_locked() {
+    if (buffer.empty()) return true;
+    bool ok = publisher.publish(cfg, buffer, false);
+    if (ok) {
+        messages++;
+    } else {
+        write_log(cfg.log_file, "MQTT batching: Dropped batch of " + std::to_string(buffer.size()) + " bytes");
+    }
+    buffer.clear();
+    return ok;
+}
+
+void MQTTBatcher::linger_loop() {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (!stopping) {
+        if (buffer.empty()) {
+            cv.wait(lock);
+            continue;
+        }
+        std::chrono::steady_clock::time_point deadline = batch_started + linger;
+        if (std::chrono::steady_clock::now() >= deadline) {
+            if (!flush_locked()) linger_failed = true;
+        } else {
+            cv.wait_until(lock, deadline);
+        }
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "config.h"
+#include "output_sink.h"
+
+// Coalesces rows into newline-separated MQTT messages. A batch is sent once it would exceed
+// MQTT_BATCH_MAX_BYTES or MQTT_BATCH_LINGER_MS after its first row, whichever comes first.
+// With MQTT_BATCH_MAX_BYTES = 0 every row is published on its own.
+class MQTTBatcher {
+public:
+    MQTTBatcher(OutputSink& publisher, const Config& cfg);
+    ~MQTTBatcher();
+
+    // Queue one row. Returns false if the row (or the batch it completed) could not be published.
+    bool add(const std::string& row);
+
+    // Send any partially filled batch now
+    bool flush();
+
+    long long getRowCount() const { return rows; }
+    long long getMessageCount() const { return messages; }
+
+private:
+    bool flush_locked();
+    void linger_loop();
+
+    OutputSink& publisher;
+    const Config cfg;
+    const size_t max_bytes;
+    const std::chrono::milliseconds linger;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::string buffer;
+    std::chrono::steady_clock::time_point batch_started;
+    bool stopping;
+    bool linger_failed;     // a linger-triggered flush failed; reported by the next add()
+    long long rows;
+    long long messages;
+    std::thread linger_thread;
+};
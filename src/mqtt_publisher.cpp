@@ -2,10 +2,48 @@
 #include <mosquitto.h>
 #include <iostream>
 #include <algorithm>
-#include <unistd.h>
+#include <chrono>
 #include "utils.h"
+#include "host_health.h"
+#include "tls_session.h"
 
-MQTTPublisher::MQTTPublisher() : connected(false), last_mid(0), message_delivered(false) {
+namespace {
+
+// TLS for the broker connection. With ENABLE_TLS_SESSION_CACHE mosquitto uses the shared
+// context from tls_session.cpp, which resumes earlier sessions; otherwise its own TLS setup.
+bool configure_tls(struct mosquitto* mosq, const Config& cfg, const std::string& host) {
+    int rc;
+#ifdef ENABLE_TLS_SESSION_CACHE
+    std::string error;
+    SSL_CTX* ctx = mqtt_tls_context(cfg, host, error);
+    if (!ctx) {
+        std::string err_msg = "MQTT TLS setup failed: " + error;
+        std::cerr << err_msg << std::endl;
+        write_log(cfg.log_file, err_msg);
+        return false;
+    }
+    mosquitto_int_option(mosq, MOSQ_OPT_SSL_CTX_WITH_DEFAULTS, 0);
+    rc = mosquitto_void_option(mosq, MOSQ_OPT_SSL_CTX, ctx);
+#else
+    (void)host;
+    const char* ca_file = cfg.mqtt_ca_file.empty() ? nullptr : cfg.mqtt_ca_file.c_str();
+    const char* cert_file = cfg.mqtt_cert_file.empty() ? nullptr : cfg.mqtt_cert_file.c_str();
+    const char* key_file = cfg.mqtt_key_file.empty() ? cert_file : cfg.mqtt_key_file.c_str();
+    rc = mosquitto_tls_set(mosq, ca_file, ca_file ? nullptr : "/etc/ssl/certs", cert_file, key_file, nullptr);
+#endif
+    if (rc != MOSQ_ERR_SUCCESS) {
+        std::string err_msg = "MQTT TLS setup failed: " + std::string(mosquitto_strerror(rc));
+        std::cerr << err_msg << std::endl;
+        write_log(cfg.log_file, err_msg);
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+MQTTPublisher::MQTTPublisher()
+    : connected(false), persistent_session(false), last_mid(0), message_delivered(false), connect_done(true) {
     mosquitto_lib_init();
 }
 
@@ -21,23 +59,81 @@ void MQTTPublisher::MosqDeleter::operator()(struct mosquitto* m) const {
 // Callback when message is published successfully
 void MQTTPublisher::on_publish_callback(struct mosquitto* mosq, void* userdata, int mid) {
     MQTTPublisher* publisher = static_cast<MQTTPublisher*>(userdata);
-    if (publisher && mid == publisher->last_mid) {
-        publisher->message_delivered = true;
+    if (!publisher) return;
+    {
+        std::lock_guard<std::mutex> lock(publisher->delivery_mtx);
+        if (publisher->unacked.erase(mid) == 0) publisher->early_acks.insert(mid);
+        if (mid == publisher->last_mid) {
+            publisher->message_delivered = true;
+        }
     }
+    publisher->delivery_cv.notify_all();
 }
 
 bool MQTTPublisher::connect(const Config& cfg) {
+    wait_for_connect();
+    return open(cfg);
+}
+
+void MQTTPublisher::connect_async(const Config& cfg) {
+    wait_for_connect();
+    if (connected && mosq) return;
+    start_connect(cfg, Deadline());
+}
+
+// mosquitto_connect_async() still resolves the broker name on the calling thread, so the whole
+// blocking connect runs on a helper thread instead; failures are logged by open()
+void MQTTPublisher::start_connect(const Config& cfg, const Deadline& deadline) {
+    // The thread may outlive the caller and its cancel flag, so it keeps only the time limit
+    Deadline limit = deadline.is_limited() ? Deadline::in(deadline.remaining_ms(0)) : Deadline();
+    connect_done = false;
+    connect_thread = std::thread([this, cfg, limit]() {
+        open(cfg, limit);
+        {
+            std::lock_guard<std::mutex> lock(delivery_mtx);
+            connect_done = true;
+        }
+        delivery_cv.notify_all();
+    });
+}
+
+bool MQTTPublisher::wait_for_connect(const Deadline& deadline) {
+    if (!connect_thread.joinable()) return true;
+    if (deadline.is_limited()) {
+        std::unique_lock<std::mutex> lock(delivery_mtx);
+        delivery_cv.wait_for(lock, std::chrono::milliseconds(deadline.remaining_ms(0)),
+                             [this] { return connect_done.load(); });
+        if (!connect_done) return false;
+    }
+    connect_thread.join();
+    return true;
+}
+
+bool MQTTPublisher::open(const Config& cfg, const Deadline& deadline) {
     if (connected && mosq) return true;
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
 
-    // Ensure we clean up any old instance before recreating
-    disconnect();
+    // A persistent session needs a stable client id; the broker keys the session on it
+    bool want_persistent = cfg.mqtt_persistent_session && !cfg.mqtt_client_id.empty();
+    if (cfg.mqtt_persistent_session && !want_persistent) {
+        write_log(cfg.log_file, "MQTT: MQTT_PERSISTENT_SESSION needs MQTT_CLIENT_ID, using a clean session");
+    }
+
+    // Ensure we clean up any old instance before recreating. A persistent session keeps its
+    // instance so QoS1 messages queued in it are retransmitted once the connection is back.
+    bool reuse_instance = mosq && persistent_session && want_persistent;
+    if (!reuse_instance) close();
+    persistent_session = want_persistent;
 
     try {
         // Parse server into host and optional port
+        bool tls = mqtt_tls_enabled(cfg);
         std::string host = cfg.mqtt_server;
-        int port = 1883;
+        int port = tls ? 8883 : 1883;
         if (host.rfind("tcp://", 0) == 0) host = host.substr(6);
         else if (host.rfind("mqtt://", 0) == 0) host = host.substr(7);
+        else if (host.rfind("ssl://", 0) == 0) host = host.substr(6);
+        else if (host.rfind("mqtts://", 0) == 0) host = host.substr(8);
 
         auto pos = host.rfind(':');
         if (pos != std::string::npos) {
@@ -48,28 +144,68 @@ bool MQTTPublisher::connect(const Config& cfg) {
             }
         }
 
-        mosq.reset(mosquitto_new(cfg.mqtt_client_id.empty() ? nullptr : cfg.mqtt_client_id.c_str(), true, this));
-        if (!mosq) {
-            std::cerr << "Failed to create mosquitto instance" << std::endl;
-            write_log(cfg.log_file, "Failed to create mosquitto instance");
+        // Fail fast on an unreachable broker: mosquitto_connect() has no connect timeout of its
+        // own and would block for the kernel's SYN retries. While the circuit is open only the
+        // breaker's periodic probe runs.
+        HostHealth& health = host_health("MQTT", host, port);
+        if (!health.allow_attempt(cfg)) {
+            write_log(cfg.log_file, "MQTT: Broker " + host + ":" + std::to_string(port) + " marked down, next probe in " +
+                      std::to_string((health.retry_delay_ms() + 999) / 1000) + " s");
+            return false;
+        }
+        std::string probe_error;
+        if (!tcp_probe(host, port, static_cast<int>(deadline.remaining_ms(cfg.connect_timeout * 1000LL)), probe_error)) {
+            std::string err_msg = "MQTT connect failed: " + probe_error;
+            std::cerr << err_msg << std::endl;
+            write_log(cfg.log_file, err_msg);
+            // A probe cut short by the caller's deadline says nothing about the broker
+            if (!deadline.expired()) health.record_failure(cfg, probe_error);
+            return false;
+        }
+        if (deadline.should_stop()) {
+            write_log(cfg.log_file, "MQTT connect abandoned: deadline exceeded");
             return false;
         }
 
-        // Set callback for publish confirmation
-        mosquitto_publish_callback_set(mosq.get(), on_publish_callback);
+        if (!reuse_instance) {
+            mosq.reset(mosquitto_new(cfg.mqtt_client_id.empty() ? nullptr : cfg.mqtt_client_id.c_str(),
+                                     !persistent_session, this));
+            if (!mosq) {
+                std::cerr << "Failed to create mosquitto instance" << std::endl;
+                write_log(cfg.log_file, "Failed to create mosquitto instance");
+                return false;
+            }
+
+            // Set callback for publish confirmation
+            mosquitto_publish_callback_set(mosq.get(), on_publish_callback);
+
+            if (!cfg.mqtt_user.empty()) {
+                mosquitto_username_pw_set(mosq.get(), cfg.mqtt_user.c_str(), cfg.mqtt_pass.c_str());
+            }
 
-        if (!cfg.mqtt_user.empty()) {
-            mosquitto_username_pw_set(mosq.get(), cfg.mqtt_user.c_str(), cfg.mqtt_pass.c_str());
+            // The loop thread reconnects on its own after a connection loss
+            mosquitto_reconnect_delay_set(mosq.get(), cfg.retry_backoff_base, cfg.retry_interval, true);
+
+            if (tls && !configure_tls(mosq.get(), cfg, host)) {
+                mosq.reset();
+                return false;
+            }
+            if (cfg.mqtt_tcp_nodelay) mosquitto_int_option(mosq.get(), MOSQ_OPT_TCP_NODELAY, 1);
         }
 
-        int rc = mosquitto_connect(mosq.get(), host.empty() ? nullptr : host.c_str(), port, 60);
+        int rc = mosquitto_connect(mosq.get(), host.empty() ? nullptr : host.c_str(), port, cfg.mqtt_keepalive);
         if (rc != MOSQ_ERR_SUCCESS) {
             std::string err_msg = "MQTT connect failed: " + std::string(mosquitto_strerror(rc));
             std::cerr << err_msg << std::endl;
             write_log(cfg.log_file, err_msg);
-            mosq.reset();
+            // The probe got through, so only a failed resolve or connect counts against the
+            // broker; TLS or protocol errors come from a broker that answered
+            if (rc == MOSQ_ERR_ERRNO || rc == MOSQ_ERR_EAI) health.record_failure(cfg, mosquitto_strerror(rc));
+            else health.record_success(cfg);
+            if (!persistent_session) mosq.reset();
             return false;
         }
+        health.record_success(cfg);
 
         // Start the network loop in a background thread
         int loop_rc = mosquitto_loop_start(mosq.get());
@@ -82,7 +218,10 @@ bool MQTTPublisher::connect(const Config& cfg) {
         }
 
         connected = true;
-        write_log(cfg.log_file, "MQTT: Connected to " + host + ":" + std::to_string(port));
+        long long connect_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - started).count();
+        write_log(cfg.log_file, "MQTT: Connected to " + host + ":" + std::to_string(port) + (tls ? " (TLS)" : "") +
+                  (persistent_session ? " (persistent session)" : "") + " in " + std::to_string(connect_ms) + " ms");
     } catch (const std::exception& e) {
         std::cerr << "Exception in MQTT connect: " << e.what() << std::endl;
         write_log(cfg.log_file, "MQTT Exception: " + std::string(e.what()));
@@ -92,10 +231,28 @@ bool MQTTPublisher::connect(const Config& cfg) {
     return true;
 }
 
-bool MQTTPublisher::publish(const Config& cfg, const std::string& payload) {
+bool MQTTPublisher::publish(const Config& cfg, const std::string& payload, bool wait_for_delivery,
+                            const Deadline& deadline) {
     if (payload.empty()) return true;
-    if (!connected || !mosq) {
-        if (!connect(cfg)) return false;
+    // With a deadline the (re)connect runs on the helper thread and is waited for only as long
+    // as the deadline allows, so DNS, the TCP connect or the broker cannot hold the caller past it
+    bool connecting = !wait_for_connect(deadline);
+    if (!connecting && (!connected || !mosq)) {
+        if (deadline.should_stop()) {
+            write_log(cfg.log_file, "MQTT publish skipped: not connected and the deadline has passed");
+            return false;
+        }
+        if (!deadline.is_limited()) {
+            if (!open(cfg)) return false;
+        } else {
+            start_connect(cfg, deadline);
+            connecting = !wait_for_connect(deadline);
+            if (!connecting && (!connected || !mosq)) return false;
+        }
+    }
+    if (connecting) {
+        write_log(cfg.log_file, "MQTT publish failed: still connecting when the deadline passed");
+        return false;
     }
 
     // Reset delivery flag
@@ -103,34 +260,43 @@ bool MQTTPublisher::publish(const Config& cfg, const std::string& payload) {
     int mid = 0;
 
     int rc = mosquitto_publish(mosq.get(), &mid, cfg.mqtt_topic.c_str(), static_cast<int>(payload.size()), payload.data(), 1, false);
-    if (rc != MOSQ_ERR_SUCCESS) {
+    bool lost = rc == MOSQ_ERR_NO_CONN || rc == MOSQ_ERR_CONN_LOST;
+    if (lost && persistent_session && mid != 0) {
+        // The message is in the session's queue and goes out when the loop thread reconnects;
+        // reporting a failure would make the caller publish it a second time
+        write_log(cfg.log_file, "MQTT publish queued until the broker connection is back (mid=" + std::to_string(mid) + ")");
+    } else if (rc != MOSQ_ERR_SUCCESS) {
         std::string err_msg = "MQTT publish failed: " + std::string(mosquitto_strerror(rc));
         std::cerr << err_msg << std::endl;
         write_log(cfg.log_file, err_msg);
-        // If connection is lost, mark it as disconnected so we retry next time
-        if (rc == MOSQ_ERR_NO_CONN || rc == MOSQ_ERR_CONN_LOST) {
+        // If connection is lost, mark it as disconnected so we retry next time.
+        // Persistent sessions are left to the loop thread's automatic reconnect.
+        if (lost && !persistent_session) {
             connected = false;
         }
         return false;
     }
 
-    // Store message ID for callback verification
+    // Store message ID for callback verification; the ack may have come before this
+    std::unique_lock<std::mutex> lock(delivery_mtx);
     last_mid = mid;
-    
-    // Wait for message to be delivered (max 5 seconds)
-    int wait_count = 0;
-    const int max_wait = 50; // 50 * 100ms = 5 seconds
-    while (!message_delivered && wait_count < max_wait) {
-        usleep(100000); // 100ms
-        wait_count++;
-    }
-    
+    if (early_acks.erase(mid) > 0) message_delivered = true;
+    else unacked.insert(mid);
+    if (!wait_for_delivery) return true;
+
+    // Wait for message to be delivered (max 5 seconds, less if the deadline is nearer);
+    // woken by the publish callback
+    long long wait_ms = deadline.remaining_ms(5000);
+    delivery_cv.wait_for(lock, std::chrono::milliseconds(wait_ms), [this] { return message_delivered.load(); });
+    lock.unlock();
+
     if (message_delivered) {
         std::cout << "Data sent to MQTT successfully (confirmed delivery)." << std::endl;
         write_log(cfg.log_file, "Data sent to MQTT successfully (confirmed delivery)");
         return true;
     } else {
-        std::string warn_msg = "MQTT publish queued but delivery not confirmed within 5 seconds (mid=" + std::to_string(mid) + ")";
+        std::string warn_msg = "MQTT publish queued but delivery not confirmed within " + std::to_string(wait_ms) +
+                               " ms (mid=" + std::to_string(mid) + ")";
         std::cerr << "WARNING: " << warn_msg << std::endl;
         write_log(cfg.log_file, "WARNING: " + warn_msg);
         // Still return true since publish was queued successfully
@@ -138,14 +304,37 @@ bool MQTTPublisher::publish(const Config& cfg, const std::string& payload) {
     }
 }
 
+bool MQTTPublisher::flush(const Config& cfg, int timeout_ms) {
+    wait_for_connect();
+    std::unique_lock<std::mutex> lock(delivery_mtx);
+    if (!connected || !mosq) return unacked.empty();
+
+    delivery_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return unacked.empty(); });
+    if (!unacked.empty()) {
+        write_log(cfg.log_file, "WARNING: MQTT flush timed out with " + std::to_string(unacked.size()) +
+                  " message(s) unconfirmed");
+        return false;
+    }
+    return true;
+}
+
 void MQTTPublisher::disconnect() {
+    wait_for_connect();
+    close();
+}
+
+void MQTTPublisher::close() {
     if (mosq) {
         if (connected) {
-            // Stop the background loop thread before disconnecting
-            mosquitto_loop_stop(mosq.get(), false);
+            // Disconnect first: without force, loop_stop only returns once the loop thread has
+            // seen a disconnect, and would otherwise wait forever
             mosquitto_disconnect(mosq.get());
+            mosquitto_loop_stop(mosq.get(), false);
         }
         mosq.reset();
     }
     connected = false;
+    std::lock_guard<std::mutex> lock(delivery_mtx);
+    unacked.clear();
+    early_acks.clear();
 }
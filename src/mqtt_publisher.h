@@ -3,8 +3,13 @@
 
 #include <string>
 #include <memory>
+#include <set>
 #include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "config.h"
+#include "deadline.h"
 
 struct mosquitto;
 
@@ -14,19 +19,45 @@ public:
     ~MQTTPublisher();
 
     bool connect(const Config& cfg);
-    bool publish(const Config& cfg, const std::string& payload);
+    // Start connecting on a helper thread (DNS, TCP and the loop thread) and return at once.
+    // connect(), publish(), flush() and disconnect() first wait for it to finish.
+    void connect_async(const Config& cfg);
+    // Publish with QoS1. When wait_for_delivery is false the message is only queued; otherwise
+    // wait for the ack for up to 5 s, or until the deadline if that comes first. A reconnect
+    // needed first is also bounded by the deadline, and skipped once it has expired.
+    bool publish(const Config& cfg, const std::string& payload, bool wait_for_delivery = true,
+                 const Deadline& deadline = Deadline());
+    // Wait until every queued message has been acknowledged (or timeout_ms elapses)
+    bool flush(const Config& cfg, int timeout_ms);
     void disconnect();
+    static const char* name() { return "mqtt"; }
 
 private:
     struct MosqDeleter {
         void operator()(struct mosquitto* m) const;
     };
+    bool open(const Config& cfg, const Deadline& deadline = Deadline());
+    void close();
+    // Run open() on connect_thread
+    void start_connect(const Config& cfg, const Deadline& deadline);
+    // Join connect_thread; with a limited deadline give up (false) once it expires
+    bool wait_for_connect(const Deadline& deadline = Deadline());
+
     std::unique_ptr<struct mosquitto, MosqDeleter> mosq;
     bool connected;
+    bool persistent_session;    // clean_session=false: instance and its queued messages survive reconnects
     
     // Message delivery tracking
     std::atomic<int> last_mid;
     std::atomic<bool> message_delivered;
+    // Guarded by delivery_mtx and changed only by publish() and the ack callback (close() drops
+    // them with the instance), so a message is counted once however often the caller retries
+    std::set<int> unacked;          // mids accepted by libmosquitto and not yet acknowledged
+    std::set<int> early_acks;       // acks that arrived before publish() recorded their mid
+    std::mutex delivery_mtx;
+    std::condition_variable delivery_cv;
+    std::thread connect_thread;     // running open(), owns mosq until joined
+    std::atomic<bool> connect_done; // connect_thread has finished; guarded by delivery_mtx for the cv
     
     // Mosquitto callbacks
     static void on_publish_callback(struct mosquitto* mosq, void* userdata, int mid);
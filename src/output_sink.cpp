@@ -0,0 +1,118 @@
+#include "output_sink.h"
+#include "utils.h"
+#include <iostream>
+#include <sstream>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+std::mutex stdout_mtx;
+
+template <typename S> std::string names_of(const S*) { return S::name(); }
+template <typename... S> std::string names_of(const FanoutSink<S...>*) { return FanoutSink<S...>::names(); }
+
+} // namespace
+
+bool sink_enabled(const Config& cfg, const char* name) {
+    if (cfg.output_sinks.empty()) return true;
+    std::stringstream ss(cfg.output_sinks);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t b = item.find_first_not_of(" \t");
+        size_t e = item.find_last_not_of(" \t");
+        if (b != std::string::npos && item.compare(b, e - b + 1, name) == 0) return true;
+    }
+    return false;
+}
+
+bool check_output_sinks(const std::string& sinks, std::string& error) {
+    if (sinks.empty()) return true;
+    std::string built = "+" + output_sink_names() + "+";
+    std::stringstream ss(sinks);
+    std::string item;
+    int count = 0;
+    while (std::getline(ss, item, ',')) {
+        size_t b = item.find_first_not_of(" \t");
+        if (b == std::string::npos) continue;
+        std::string name = item.substr(b, item.find_last_not_of(" \t") - b + 1);
+        if (built.find("+" + name + "+") == std::string::npos) {
+            error = "unknown or not compiled-in sink '" + name + "' (this build has " + output_sink_names() + ")";
+            return false;
+        }
+        count++;
+    }
+    if (count == 0) {
+        error = "no sink named (this build has " + output_sink_names() + ")";
+        return false;
+    }
+    return true;
+}
+
+std::string output_sink_names() {
+    return names_of(static_cast<const OutputSink*>(nullptr));
+}
+
+// ============================================================================
+// StdoutSink
+// ============================================================================
+
+bool StdoutSink::publish(const Config& cfg, const std::string& payload, bool, const Deadline&) {
+    if (payload.empty()) return true;
+    std::lock_guard<std::mutex> lock(stdout_mtx);
+    std::cout << cfg.mqtt_topic << " " << payload << std::endl;
+    return true;
+}
+
+// ============================================================================
+// FileSink
+// ============================================================================
+
+FileSink::FileSink() : fd(-1) {}
+
+FileSink::~FileSink() {
+    disconnect();
+}
+
+bool FileSink::connect(const Config& cfg) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (fd >= 0 && path == cfg.output_file) return true;
+    if (fd >= 0) ::close(fd);
+    path = cfg.output_file;
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        std::string err_msg = "Output file " + path + " cannot be opened: " + std::strerror(errno);
+        std::cerr << err_msg << std::endl;
+        write_log(cfg.log_file, err_msg);
+        return false;
+    }
+    return true;
+}
+
+bool FileSink::publish(const Config& cfg, const std::string& payload, bool, const Deadline&) {
+    if (payload.empty()) return true;
+    if (!connect(cfg)) return false;
+
+    std::string line;
+    line.reserve(cfg.mqtt_topic.size() + payload.size() + 2);
+    line.append(cfg.mqtt_topic).append(1, ' ').append(payload).append(1, '\n');
+    std::lock_guard<std::mutex> lock(mtx);
+    if (::write(fd, line.data(), line.size()) != static_cast<ssize_t>(line.size())) {
+        write_log(cfg.log_file, "Output file " + path + " write failed: " + std::strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool FileSink::flush(const Config&, int) {
+    std::lock_guard<std::mutex> lock(mtx);
+    return fd < 0 || fsync(fd) == 0;
+}
+
+void FileSink::disconnect() {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <atomic>
+#include "config.h"
+#include "deadline.h"
+
+#ifdef ENABLE_MQTT
+#include "mqtt_publisher.h"
+#endif
+
+// Where published rows go. The sinks are chosen at build time with CMake options
+// (ENABLE_MQTT, ENABLE_STDOUT_SINK, ENABLE_FILE_SINK, ENABLE_NULL_SINK) and OutputSink below is
+// the one enabled sink, or a FanoutSink of all of them, as a concrete type: calls inline with
+// no virtual dispatch. In a fan-out build OUTPUT_SINKS in config.json picks the active subset.
+//
+// Every sink has the interface of MQTTPublisher:
+//   bool connect(const Config&);          void connect_async(const Config&);
+//   bool publish(const Config&, const std::string& payload, bool wait_for_delivery = true,
+//                const Deadline& deadline = Deadline());
+//   bool flush(const Config&, int timeout_ms);   void disconnect();
+//   static const char* name();
+// and publishes to cfg.mqtt_topic (which callers set per stream: live, alarm, backfill).
+// A sink that waits for delivery stops waiting when the deadline expires.
+
+// Prints "topic payload" lines to stdout
+class StdoutSink {
+public:
+    bool connect(const Config&) { return true; }
+    void connect_async(const Config&) {}
+    bool publish(const Config& cfg, const std::string& payload, bool wait_for_delivery = true,
+                 const Deadline& deadline = Deadline());
+    bool flush(const Config&, int) { return true; }
+    void disconnect() {}
+    static const char* name() { return "stdout"; }
+};
+
+// Appends "topic payload" lines to OUTPUT_FILE; one write() per message, so several instances
+// (live, alarm, backfill) can share the file
+class FileSink {
+public:
+    FileSink();
+    ~FileSink();
+
+    bool connect(const Config& cfg);
+    void connect_async(const Config& cfg) { connect(cfg); }
+    bool publish(const Config& cfg, const std::string& payload, bool wait_for_delivery = true,
+                 const Deadline& deadline = Deadline());
+    bool flush(const Config& cfg, int timeout_ms);
+    void disconnect();
+    static const char* name() { return "file"; }
+
+private:
+    std::mutex mtx;
+    std::string path;
+    int fd;
+};
+
+// Accepts and discards everything; for measuring the pipeline without broker effects
+class NullSink {
+public:
+    NullSink() : messages(0), bytes(0) {}
+
+    bool connect(const Config&) { return true; }
+    void connect_async(const Config&) {}
+    bool publish(const Config&, const std::string& payload, bool = true, const Deadline& = Deadline()) {
+        messages.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(payload.size(), std::memory_order_relaxed);
+        return true;
+    }
+    bool flush(const Config&, int) { return true; }
+    void disconnect() {}
+    static const char* name() { return "null"; }
+
+    unsigned long message_count() const { return messages.load(std::memory_order_relaxed); }
+    unsigned long byte_count() const { return bytes.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<unsigned long> messages;
+    std::atomic<unsigned long> bytes;
+};
+
+// True if OUTPUT_SINKS is empty (all compiled-in sinks) or lists name
+bool sink_enabled(const Config& cfg, const char* name);
+
+// Checks that every name in an OUTPUT_SINKS list is a compiled-in sink and that the list enables
+// at least one; on failure sets error
+bool check_output_sinks(const std::string& sinks, std::string& error);
+
+// Publishes to every compiled-in sink that OUTPUT_SINKS enables; succeeds only if all of them do
+template <typename... Sinks> class FanoutSink;
+
+template <>
+class FanoutSink<> {
+public:
+    bool connect(const Config&) { return true; }
+    void connect_async(const Config&) {}
+    bool publish(const Config&, const std::string&, bool = true, const Deadline& = Deadline()) { return true; }
+    bool flush(const Config&, int) { return true; }
+    void disconnect() {}
+    static std::string names() { return ""; }
+};
+
+template <typename First, typename... Rest>
+class FanoutSink<First, Rest...> {
+public:
+    bool connect(const Config& cfg) {
+        bool ok = !sink_enabled(cfg, First::name()) || first.connect(cfg);
+        return rest.connect(cfg) && ok;
+    }
+    void connect_async(const Config& cfg) {
+        if (sink_enabled(cfg, First::name())) first.connect_async(cfg);
+        rest.connect_async(cfg);
+    }
+    bool publish(const Config& cfg, const std::string& payload, bool wait_for_delivery = true,
+                 const Deadline& deadline = Deadline()) {
+        bool ok = !sink_enabled(cfg, First::name()) || first.publish(cfg, payload, wait_for_delivery, deadline);
+        return rest.publish(cfg, payload, wait_for_delivery, deadline) && ok;
+    }
+    bool flush(const Config& cfg, int timeout_ms) {
+        bool ok = !sink_enabled(cfg, First::name()) || first.flush(cfg, timeout_ms);
+        return rest.flush(cfg, timeout_ms) && ok;
+    }
+    // Disconnects every sink, so one that OUTPUT_SINKS just turned off is closed too
+    void disconnect() {
+        first.disconnect();
+        rest.disconnect();
+    }
+    static std::string names() {
+        std::string tail = FanoutSink<Rest...>::names();
+        return std::string(First::name()) + (tail.empty() ? "" : "+" + tail);
+    }
+
+private:
+    First first;
+    FanoutSink<Rest...> rest;
+};
+
+// ============================================================================
+// OutputSink: the build's sink type
+// ============================================================================
+
+namespace sink_detail {
+
+template <typename... Sinks> struct List {};
+
+template <typename L, typename S> struct Append;
+template <typename... Sinks, typename S> struct Append<List<Sinks...>, S> { typedef List<Sinks..., S> type; };
+
+// A single sink is used directly; two or more are wrapped in a FanoutSink
+template <typename L> struct Select;
+template <typename S> struct Select<List<S> > { typedef S type; };
+template <typename A, typename B, typename... Rest> struct Select<List<A, B, Rest...> > {
+    typedef FanoutSink<A, B, Rest...> type;
+};
+
+typedef List<> Sinks0;
+#ifdef ENABLE_MQTT
+typedef Append<Sinks0, MQTTPublisher>::type Sinks1;
+#else
+typedef Sinks0 Sinks1;
+#endif
+#ifdef ENABLE_STDOUT_SINK
+typedef Append<Sinks1, StdoutSink>::type Sinks2;
+#else
+typedef Sinks1 Sinks2;
+#endif
+#ifdef ENABLE_FILE_SINK
+typedef Append<Sinks2, FileSink>::type Sinks3;
+#else
+typedef Sinks2 Sinks3;
+#endif
+#ifdef ENABLE_NULL_SINK
+typedef Append<Sinks3, NullSink>::type Sinks4;
+#else
+typedef Sinks3 Sinks4;
+#endif
+
+} // namespace sink_detail
+
+#if !defined(ENABLE_MQTT) && !defined(ENABLE_STDOUT_SINK) && !defined(ENABLE_FILE_SINK) && !defined(ENABLE_NULL_SINK)
+#error "No output sink enabled: configure with -DENABLE_MQTT=ON or another ENABLE_*_SINK option"
+#endif
+
+typedef sink_detail::Select<sink_detail::Sinks4>::type OutputSink;
+
+// Names of the compiled-in sinks, e.g. "mqtt" or "mqtt+file"
+std::string output_sink_names();
@@ -2,59 +2,77 @@
 #include <fstream>
 #include <string>
 #include <iostream>
+#include <vector>
+#include "scan.h"
+
+namespace {
+
+const size_t READ_BLOCK = 64 * 1024;
+
+bool is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// Trim spaces/tabs; false if nothing is left
+bool trim_row(const char*& begin, const char*& end) {
+    while (begin < end && is_blank(*begin)) ++begin;
+    while (end > begin && is_blank(end[-1])) --end;
+    return begin < end;
+}
+
+} // namespace
 
 std::string get_latest_row(const std::string& local_file) {
     if (local_file.empty()) return "";
     
     try {
         // Open in binary mode to handle \r and \n correctly regardless of platform
-        std::ifstream file(local_file, std::ios::binary);
+        std::ifstream file(local_file, std::ios::binary | std::ios::ate);
         if (!file.is_open()) {
             return "";
         }
 
+        // Only the tail of the file is read: start with one block and double the window until
+        // it holds a complete non-empty line (or the whole file)
+        const ScanSet eol("\r\n");
+        std::streamoff file_size = file.tellg();
         std::string last_line;
-        std::string current_line;
-        char ch;
-        
-        // Read file character by character to avoid loading entire file into memory
-        while (file.get(ch)) {
-            if (ch == '\n') {
-                // End of line - check if current_line has content
-                if (current_line.find_first_not_of(" \t\r") != std::string::npos) {
-                    last_line = current_line;
-                }
-                current_line.clear();
-            } else if (ch == '\r') {
-                // Handle \r - peek next char to see if it's \r\n
-                if (file.peek() == '\n') {
-                    file.get(ch); // consume the \n
-                }
-                // End of line
-                if (current_line.find_first_not_of(" \t\r") != std::string::npos) {
-                    last_line = current_line;
+        std::vector<char> window;
+        for (std::streamoff want = static_cast<std::streamoff>(READ_BLOCK); ; want *= 2) {
+            std::streamoff offset = want < file_size ? file_size - want : 0;
+            window.resize(static_cast<size_t>(file_size - offset));
+            file.seekg(offset);
+            if (!file.read(window.data(), static_cast<std::streamsize>(window.size()))) return "";
+
+            // Walk the lines of the window, keeping the last non-empty one. The first line of the
+            // window may be cut off unless the window starts at the beginning of the file.
+            const char* begin = window.data();
+            const char* end = begin + window.size();
+            const char* best_begin = nullptr;
+            const char* best_end = nullptr;
+            bool best_complete = false;
+            const char* line = begin;
+            while (true) {
+                const char* line_end = line + scan_for(line, static_cast<size_t>(end - line), eol);
+                const char* b = line;
+                const char* e = line_end;
+                if (trim_row(b, e)) {
+                    best_begin = b;
+                    best_end = e;
+                    best_complete = line != begin || offset == 0;
                 }
-                current_line.clear();
-            } else {
-                current_line += ch;
+                if (line_end == end) break;
+                line = line_end + 1;
             }
+            if (best_begin && best_complete) {
+                last_line.assign(best_begin, best_end);
+                break;
+            }
+            if (offset == 0) break;  // whole file read, no data rows
         }
-        
-        // Don't forget the last line if file doesn't end with newline
-        if (current_line.find_first_not_of(" \t\r\n") != std::string::npos) {
-            last_line = current_line;
-        }
-        
         file.close();
 
-        // Final trim of any whitespace around the data
         if (!last_line.empty()) {
-            size_t first = last_line.find_first_not_of(" \t\r\n");
-            size_t last = last_line.find_last_not_of(" \t\r\n");
-            if (first != std::string::npos && last != std::string::npos) {
-                last_line = last_line.substr(first, (last - first + 1));
-            }
-            
             std::cout << "Latest row valid. Length: " << last_line.length() << " characters." << std::endl;
             std::string snippet = last_line.length() > 60 ? last_line.substr(0, 60) + "..." : last_line;
             std::cout << "Data: [" << snippet << "]" << std::endl;
@@ -66,3 +84,54 @@ std::string get_latest_row(const std::string& local_file) {
         return "";
     }
 }
+
+long for_each_row(const std::string& local_file, const std::function<bool(const std::string&)>& fn) {
+    if (local_file.empty()) return -1;
+
+    std::ifstream file(local_file, std::ios::binary);
+    if (!file.is_open()) {
+        return -1;
+    }
+
+    // Lines end at \n, \r or \r\n (the empty line between \r and \n is skipped like any other).
+    // The file is read in blocks; a line cut by a block boundary is carried over.
+    const ScanSet eol("\r\n");
+    std::vector<char> block(READ_BLOCK);
+    std::vector<uint32_t> line_ends(1024);
+    std::string carry;
+    long rows = 0;
+
+    auto emit = [&](const char* b, const char* e) {
+        if (!trim_row(b, e)) return true;
+        rows++;
+        return fn(std::string(b, e));
+    };
+
+    while (file.read(block.data(), static_cast<std::streamsize>(block.size())) || file.gcount() > 0) {
+        const char* data = block.data();
+        size_t len = static_cast<size_t>(file.gcount());
+        size_t line_start = 0;
+        while (line_start < len) {
+            // Line ends of the rest of the block, at most line_ends.size() per pass
+            size_t found = scan_all(data + line_start, len - line_start, eol, line_ends.data(), line_ends.size());
+            size_t base = line_start;
+            for (size_t i = 0; i < found; ++i) {
+                size_t line_end = base + line_ends[i];
+                bool more;
+                if (carry.empty()) {
+                    more = emit(data + line_start, data + line_end);
+                } else {
+                    carry.append(data + line_start, data + line_end);
+                    more = emit(carry.data(), carry.data() + carry.size());
+                    carry.clear();
+                }
+                if (!more) return rows;
+                line_start = line_end + 1;
+            }
+            if (found < line_ends.size()) break;
+        }
+        if (line_start < len) carry.append(data + line_start, data + len);
+    }
+    if (!carry.empty()) emit(carry.data(), carry.data() + carry.size());
+    return rows;
+}
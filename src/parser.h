@@ -1,6 +1,11 @@
 #pragma once
 
 #include <string>
+#include <functional>
 
 // Returns the last non-empty line from the given local file. Returns empty string if not available.
 std::string get_latest_row(const std::string& local_file);
+
+// Calls fn with every non-empty line (trimmed) of the given local file, oldest first.
+// Stops early when fn returns false. Returns the number of rows visited, or -1 if the file could not be opened.
+long for_each_row(const std::string& local_file, const std::function<bool(const std::string&)>& fn);
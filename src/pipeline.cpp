@@ -0,0 +1,406 @@
+#include "pipeline.h"
+#include "ftp_downloader.h"
+#include "parser.h"
+#include "utils.h"
+#include "tls_session.h"
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cstdio>
+#include <json/json.h>
+
+namespace {
+
+long long elapsed_ms(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+// Alarm messages waiting for the alarm connection; a full queue drops the new message
+const size_t ALARM_QUEUE_DEPTH = 8;
+
+int whole_seconds(long long ms) {
+    return static_cast<int>(std::max(1LL, (ms + 999) / 1000));
+}
+
+Config alarm_publish_config(const Config& cfg) {
+    Config alarm_cfg = cfg;
+    if (!cfg.mqtt_client_id.empty()) alarm_cfg.mqtt_client_id = cfg.mqtt_client_id + "_alarm";
+    alarm_cfg.mqtt_topic = cfg.alarm_topic;
+    return alarm_cfg;
+}
+
+} // namespace
+
+// ============================================================================
+// StageMetrics
+// ============================================================================
+
+StageMetrics::StageMetrics(const std::string& name)
+    : name(name), count(0), failures(0), last_ms(0), total_ms(0), max_ms(0), blocked_ms(0), max_depth(0) {}
+
+void StageMetrics::record(long long latency_ms, bool ok) {
+    std::lock_guard<std::mutex> lock(mtx);
+    count++;
+    if (!ok) failures++;
+    last_ms = latency_ms;
+    total_ms += latency_ms;
+    max_ms = std::max(max_ms, latency_ms);
+}
+
+void StageMetrics::add_blocked(long long ms) {
+    std::lock_guard<std::mutex> lock(mtx);
+    blocked_ms += ms;
+}
+
+void StageMetrics::observe_depth(size_t depth) {
+    std::lock_guard<std::mutex> lock(mtx);
+    max_depth = std::max(max_depth, depth);
+}
+
+std::string StageMetrics::summary() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    std::ostringstream oss;
+    oss << name << ": n=" << count << " fail=" << failures
+        << " last=" << last_ms << "ms avg=" << (count ? total_ms / static_cast<long long>(count) : 0)
+        << "ms max=" << max_ms << "ms blocked=" << blocked_ms << "ms max_queue=" << max_depth;
+    return oss.str();
+}
+
+// ============================================================================
+// Pipeline
+// ============================================================================
+
+Pipeline::Pipeline(ConfigManager& config_manager, OutputSink& sink)
+    : config_manager(config_manager), sink(sink),
+      fetched(static_cast<size_t>(config_manager.current()->pipeline_queue_depth)),
+      parsed(static_cast<size_t>(config_manager.current()->pipeline_queue_depth)),
+      alarms_out(ALARM_QUEUE_DEPTH),
+      fetch_metrics("fetch"), parse_metrics("parse"), publish_metrics("publish"), alarm_metrics("alarm"),
+      end_to_end("cycle"),
+      stopping(false), alarm_active(false), cycle_count(0),
+      missed_discover(0), missed_download(0), missed_publish(0), missed_cycle(0) {}
+
+Pipeline::~Pipeline() {
+    stop();
+}
+
+void Pipeline::start() {
+    std::shared_ptr<const Config> cfg = config_manager.current();
+    if (!cfg->ts_store_dir.empty() && store.open(*cfg)) {
+        backfiller.set_store(&store);
+    }
+    if (!cfg->local_ring_path.empty() && ring.open(*cfg)) {
+        backfiller.set_local_ring(&ring);
+    }
+
+    // Connected up front so the first alarm does not pay for the handshake
+    if (!cfg->alarm_rules.empty()) alarm_sink.connect_async(alarm_publish_config(*cfg));
+
+    stopping = false;
+    fetch_thread = std::thread(&Pipeline::fetch_loop, this);
+    parse_thread = std::thread(&Pipeline::parse_loop, this);
+    publish_thread = std::thread(&Pipeline::publish_loop, this);
+    alarm_thread = std::thread(&Pipeline::alarm_loop, this);
+}
+
+void Pipeline::stop() {
+    stopping = true;
+    if (fetch_thread.joinable()) fetch_thread.join();
+    if (parse_thread.joinable()) parse_thread.join();
+    if (publish_thread.joinable()) publish_thread.join();
+    if (alarm_thread.joinable()) alarm_thread.join();
+    // Files fetched but never parsed
+    FetchedFile item;
+    while (fetched.try_pop(item)) std::remove(item.local_file.c_str());
+}
+
+void Pipeline::log_metrics(const Config& cfg) const {
+    std::ostringstream oss;
+    oss << "Pipeline metrics - " << fetch_metrics.summary()
+        << " | fetch->parse queue " << fetched.size() << "/" << fetched.capacity()
+        << " | " << parse_metrics.summary()
+        << " | parse->publish queue " << parsed.size() << "/" << parsed.capacity()
+        << " | " << publish_metrics.summary()
+        << " | " << end_to_end.summary();
+    if (!cfg.alarm_rules.empty()) oss << " | " << alarm_metrics.summary();
+    write_log(cfg.log_file, oss.str());
+    write_log(cfg.log_file, "Host health - " + host_health_summary());
+    write_log(cfg.log_file, "Deadline misses - discover=" + std::to_string(missed_discover.load()) +
+              " download=" + std::to_string(missed_download.load()) +
+              " publish=" + std::to_string(missed_publish.load()) +
+              " cycle=" + std::to_string(missed_cycle.load()));
+    if (ring.is_open()) write_log(cfg.log_file, "Local ring - " + ring.summary());
+    std::string tls = tls_stats_summary();
+    if (!tls.empty()) write_log(cfg.log_file, tls);
+}
+
+void Pipeline::count_miss(std::atomic<unsigned long>& counter, const char* phase, const Config& cfg) {
+    counter++;
+    write_log(cfg.log_file, std::string("Deadline missed: ") + phase);
+}
+
+// Block the producing stage while the queue is full; returns false if the pipeline is stopping
+template <typename T>
+bool Pipeline::push_wait(SpscQueue<T>& queue, T& item, StageMetrics& producer) {
+    if (queue.try_push(item)) return true;
+
+    std::chrono::steady_clock::time_point blocked_since = std::chrono::steady_clock::now();
+    while (!stopping) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        if (queue.try_push(item)) {
+            producer.add_blocked(elapsed_ms(blocked_since));
+            return true;
+        }
+    }
+    producer.add_blocked(elapsed_ms(blocked_since));
+    return false;
+}
+
+// Wait for the next item with a growing sleep (1 ms .. 100 ms) so idle stages stay cheap
+template <typename T>
+bool Pipeline::pop_wait(SpscQueue<T>& queue, T& item, StageMetrics& consumer) {
+    int backoff_ms = 1;
+    while (!stopping) {
+        size_t depth = queue.size();
+        if (queue.try_pop(item)) {
+            consumer.observe_depth(depth);
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+        backoff_ms = std::min(backoff_ms * 2, 100);
+    }
+    return false;
+}
+
+// Sleep between fetch cycles; wakes early when stopping or when a reload changed the poll or
+// retry timing. Other reloads apply from the next cycle, so pushing a config file to a fleet
+// does not make every gateway poll and publish at the same moment.
+// A poll wait also ends after ALARM_POLL_INTERVAL once an alarm is active.
+void Pipeline::wait_interval(const std::shared_ptr<const Config>& cfg, int seconds, bool poll) {
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    std::shared_ptr<const Config> seen = cfg;
+    while (!stopping) {
+        long long waited = elapsed_ms(started);
+        if (waited >= seconds * 1000LL) break;
+        if (poll && alarm_active && waited >= cfg->alarm_poll_interval * 1000LL) break;
+        config_manager.wait_for_change(std::chrono::seconds(1));
+        std::shared_ptr<const Config> latest = config_manager.current();
+        if (latest != seen) {
+            if (schedule_settings_changed(*seen, *latest)) break;
+            seen = latest;
+        }
+    }
+}
+
+void Pipeline::fetch_loop() {
+    bool first_fetch = true;
+    unsigned long downloads = 0;    // successful downloads; names the per-cycle files
+    while (!stopping) {
+        std::shared_ptr<const Config> cfg = config_manager.current();
+
+        // While the controller is marked down only the circuit breaker's TCP probes run
+        HostHealth& ftp_health = ftp_host_health(*cfg);
+        if (!ftp_health.allow_attempt(*cfg)) {
+            wait_interval(cfg, whole_seconds(ftp_health.retry_delay_ms()));
+            continue;
+        }
+        cycle_count++;
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        // Stopping the pipeline cancels a transfer in progress instead of waiting for its timeout
+        Deadline cycle = Deadline::in(cfg->cycle_budget_ms, &stopping);
+
+        FetchedFile item;
+        bool ok = false;
+        try {
+            std::string error;
+            Deadline discover = cycle.phase(cfg->discover_budget_ms);
+            std::string remote_filename = discover_latest_file(*cfg, error, discover);
+            if (!remote_filename.empty()) {
+                write_log(cfg->log_file, "Cycle start: Latest file identified as " + remote_filename);
+                Deadline download = cycle.phase(cfg->download_budget_ms);
+                // Each download gets its own file, so a queued item is not replaced by the next one.
+                // At most capacity + 2 are in use (queued, being parsed, being downloaded), so the
+                // names are reused round robin and files left by a killed process get overwritten.
+                // Only successful downloads advance the name: a failed one never replaces the file
+                // (it writes a .tmp first), so its name is still free for the next attempt.
+                std::string local_file = cfg->local_file + ".fetch" +
+                                         std::to_string(downloads % (fetched.capacity() + 2));
+                if (download_ftp_to(*cfg, remote_filename, local_file, error, download)) {
+                    downloads++;
+                    item.remote_filename = remote_filename;
+                    item.local_file = local_file;
+                    item.cycle_start = started;
+                    item.cycle = cycle;
+                    ok = true;
+                } else {
+                    if (download.expired()) count_miss(missed_download, "download", *cfg);
+                    std::cerr << "FTP download failed: " << error << std::endl;
+                    write_log(cfg->log_file, "Cycle error: FTP failed: " + error);
+                }
+            } else {
+                if (discover.expired()) count_miss(missed_discover, "discover", *cfg);
+                std::cerr << "File discovery failed: " << error << std::endl;
+                write_log(cfg->log_file, "Cycle error: Discovery failed: " + error);
+            }
+            if (!ok && cycle.expired()) count_miss(missed_cycle, "cycle", *cfg);
+        } catch (const std::exception& e) {
+            std::string err_msg = "Unexpected error in fetch stage: " + std::string(e.what());
+            std::cerr << err_msg << std::endl;
+            write_log(cfg->log_file, err_msg);
+        }
+        fetch_metrics.record(elapsed_ms(started), ok);
+        if (ok && first_fetch) {
+            write_log(cfg->log_file, "Startup: first file ready after " + std::to_string(ms_since_start()) + " ms");
+            first_fetch = false;
+        }
+
+        if (ok && !push_wait(fetched, item, fetch_metrics)) {
+            std::remove(item.local_file.c_str());
+            break;
+        }
+        if (ok) {
+            wait_interval(cfg, cfg->poll_interval, true);
+        } else {
+            // Host failures back off per the circuit breaker; other errors (e.g. no day files yet)
+            // keep the flat RETRY_INTERVAL
+            long long delay_ms = ftp_health.retry_delay_ms();
+            int delay = delay_ms > 0 ? whole_seconds(delay_ms) : cfg->retry_interval;
+            std::cout << "Retrying FTP in " << delay << " seconds..." << std::endl;
+            wait_interval(cfg, delay);
+        }
+    }
+}
+
+void Pipeline::parse_loop() {
+    AlarmEvaluator alarms;
+    std::shared_ptr<const Config> rules_cfg;
+    FetchedFile item;
+    while (pop_wait(fetched, item, parse_metrics)) {
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        ParsedRow parsed_row;
+        parsed_row.remote_filename = item.remote_filename;
+        parsed_row.cycle_start = item.cycle_start;
+        parsed_row.cycle = item.cycle;
+        if (store.is_open()) store.ingest_file(item.local_file);
+        parsed_row.row = get_latest_row(item.local_file);
+        bool ok = !parsed_row.row.empty();
+        // Done with the cycle's file: it becomes LOCAL_FILE, the latest day file on disk
+        if (std::rename(item.local_file.c_str(), config_manager.current()->local_file.c_str()) != 0) {
+            std::remove(item.local_file.c_str());
+        }
+        parse_metrics.record(elapsed_ms(started), ok);
+
+        if (!ok) {
+            write_log(config_manager.current()->log_file, "Cycle warning: No data row in " + item.remote_filename);
+            continue;
+        }
+        check_alarms(alarms, rules_cfg, parsed_row.row);
+        if (!push_wait(parsed, parsed_row, parse_metrics)) break;
+    }
+}
+
+// Evaluate the alarm rules on the newest row. A match is handed at once to the alarm thread,
+// ahead of whatever is queued for the publish stage, and again for every new row while it
+// lasts; the first row that matches no rule sends "cleared".
+void Pipeline::check_alarms(AlarmEvaluator& alarms, std::shared_ptr<const Config>& rules_cfg, const std::string& row) {
+    std::shared_ptr<const Config> cfg = config_manager.current();
+    if (cfg != rules_cfg) {
+        if (!rules_cfg || cfg->alarm_rules != rules_cfg->alarm_rules) {
+            std::string error;
+            alarms.configure(cfg->alarm_rules, error);  // already validated when the file was loaded
+            if (!alarms.enabled()) alarm_active = false;
+        }
+        rules_cfg = cfg;
+    }
+    if (!alarms.enabled()) return;
+
+    uint32_t hits = alarms.evaluate(row);
+    if (!alarms.fresh() || (hits == 0 && !alarm_active)) return;
+
+    const char* state = hits == 0 ? "cleared" : alarm_active ? "active" : "raised";
+    std::string rules = alarms.describe(hits);
+    if (hits != 0 && !alarm_active) {
+        write_log(cfg->log_file, "Alarm raised: " + rules + ", polling every " +
+                  std::to_string(std::min(cfg->alarm_poll_interval, cfg->poll_interval)) + " s");
+    } else if (hits == 0) {
+        write_log(cfg->log_file, "Alarm cleared, polling every " + std::to_string(cfg->poll_interval) + " s");
+    }
+    alarm_active = hits != 0;
+
+    Json::Value message;
+    message["state"] = state;
+    message["rules"] = rules;
+    message["row"] = row;
+    Json::StreamWriterBuilder writer;
+    writer["indentation"] = "";
+    std::string payload = Json::writeString(writer, message);
+    if (!alarms_out.try_push(payload)) {
+        write_log(cfg->log_file, std::string("Alarm warning: alarm queue full, dropped \"") + state + "\" message");
+    }
+}
+
+// Publishes queued alarms on the alarm connection. Waiting for the ack (or a reconnect) here
+// holds up only later alarms, never the parse stage and the live rows behind it.
+void Pipeline::alarm_loop() {
+    std::shared_ptr<const Config> active_cfg = config_manager.current();
+    std::string payload;
+    while (pop_wait(alarms_out, payload, alarm_metrics)) {
+        std::shared_ptr<const Config> cfg = config_manager.current();
+        if (cfg != active_cfg) {
+            if (mqtt_settings_changed(*active_cfg, *cfg)) alarm_sink.disconnect();
+            active_cfg = cfg;
+        }
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        bool ok = alarm_sink.publish(alarm_publish_config(*cfg), payload, true, Deadline::in(cfg->publish_budget_ms));
+        alarm_metrics.record(elapsed_ms(started), ok);
+        if (!ok) write_log(cfg->log_file, "Alarm warning: publish to " + cfg->alarm_topic + " failed");
+    }
+}
+
+void Pipeline::publish_loop() {
+    std::shared_ptr<const Config> active_cfg = config_manager.current();
+    bool first_publish = true;
+    ParsedRow item;
+    while (pop_wait(parsed, item, publish_metrics)) {
+        std::shared_ptr<const Config> cfg = config_manager.current();
+        try {
+            // Only the MQTT session is restarted on reload, and only if broker settings changed
+            // (or OUTPUT_SINKS did, so a sink switched off is closed)
+            if (cfg != active_cfg) {
+                if (mqtt_settings_changed(*active_cfg, *cfg) || active_cfg->output_sinks != cfg->output_sinks) {
+                    write_log(cfg->log_file, "Config reload: MQTT settings changed, reconnecting");
+                    sink.disconnect();
+                }
+                active_cfg = cfg;
+            }
+
+            // Local consumers get the row first; they must not wait for the uplink
+            if (ring.is_open()) ring.write(item.row);
+
+            // The broker ack is waited for only as long as the cycle budget allows; a row whose
+            // cycle ran out while queued is still published, without waiting
+            std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+            Deadline deadline = item.cycle.phase(cfg->publish_budget_ms);
+            bool ok = sink.publish(*cfg, item.row, true, deadline);
+            publish_metrics.record(elapsed_ms(started), ok);
+            end_to_end.record(elapsed_ms(item.cycle_start), ok);
+            if (deadline.expired()) count_miss(missed_publish, "publish", *cfg);
+            if (item.cycle.expired()) count_miss(missed_cycle, "cycle", *cfg);
+
+            if (ok) {
+                write_log(cfg->log_file, "Cycle success: Data published to MQTT.");
+                if (first_publish) {
+                    write_log(cfg->log_file, "Startup: time to first publish " + std::to_string(ms_since_start()) + " ms");
+                    first_publish = false;
+                }
+                update_checkpoint(*cfg, item.remote_filename, backfiller);
+            } else {
+                write_log(cfg->log_file, "Cycle warning: MQTT publish failed.");
+            }
+        } catch (const std::exception& e) {
+            std::string err_msg = "Unexpected error in publish stage: " + std::string(e.what());
+            std::cerr << err_msg << std::endl;
+            write_log(cfg->log_file, err_msg);
+        }
+    }
+}
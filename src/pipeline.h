@@ -0,0 +1,115 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include "config.h"
+#include "config_manager.h"
+#include "output_sink.h"
+#include "backfill.h"
+#include "spsc_queue.h"
+#include "ts_store.h"
+#include "local_ring.h"
+#include "alarm.h"
+#include "host_health.h"
+#include "deadline.h"
+
+// Per-stage latency and backpressure counters. Updated once per item, so a mutex is cheap enough.
+class StageMetrics {
+public:
+    explicit StageMetrics(const std::string& name);
+
+    void record(long long latency_ms, bool ok);
+    void add_blocked(long long blocked_ms);
+    void observe_depth(size_t depth);
+
+    // One-line summary, e.g. "fetch: n=12 fail=1 last=130ms avg=142ms max=410ms blocked=0ms"
+    std::string summary() const;
+
+private:
+    const std::string name;
+    mutable std::mutex mtx;
+    unsigned long long count;
+    unsigned long long failures;
+    long long last_ms;
+    long long total_ms;
+    long long max_ms;
+    long long blocked_ms;
+    size_t max_depth;
+};
+
+// Daemon cycle split into fetch (discover + download), parse (latest row) and publish stages,
+// each on its own thread and connected by bounded SPSC queues. A full queue blocks the
+// producing stage (explicit backpressure) instead of dropping data; a slow broker therefore
+// only stalls FTP polling once PIPELINE_QUEUE_DEPTH cycles are waiting to be published.
+class Pipeline {
+public:
+    Pipeline(ConfigManager& config_manager, OutputSink& sink);
+    ~Pipeline();
+
+    void start();
+    void stop();
+
+    // Number of fetch cycles started so far
+    unsigned long long cycles() const { return cycle_count; }
+
+    // Log per-stage latency and queue-depth metrics
+    void log_metrics(const Config& cfg) const;
+
+private:
+    struct FetchedFile {
+        std::string remote_filename;
+        std::string local_file;
+        std::chrono::steady_clock::time_point cycle_start;
+        Deadline cycle;             // CYCLE_BUDGET_MS from cycle_start
+    };
+    struct ParsedRow {
+        std::string remote_filename;
+        std::string row;
+        std::chrono::steady_clock::time_point cycle_start;
+        Deadline cycle;
+    };
+
+    void fetch_loop();
+    void parse_loop();
+    void publish_loop();
+    void alarm_loop();
+
+    template <typename T> bool push_wait(SpscQueue<T>& queue, T& item, StageMetrics& producer);
+    template <typename T> bool pop_wait(SpscQueue<T>& queue, T& item, StageMetrics& consumer);
+    void wait_interval(const std::shared_ptr<const Config>& cfg, int seconds, bool poll = false);
+    void check_alarms(AlarmEvaluator& alarms, std::shared_ptr<const Config>& rules_cfg, const std::string& row);
+    void count_miss(std::atomic<unsigned long>& counter, const char* phase, const Config& cfg);
+
+    ConfigManager& config_manager;
+    OutputSink& sink;
+    OutputSink alarm_sink;      // own connection: alarms never wait behind the live session's queue
+    TimeSeriesStore store;      // declared first: a running backfill appends to it until destroyed
+    LocalRing ring;             // likewise
+    Backfiller backfiller;
+
+    SpscQueue<FetchedFile> fetched;
+    SpscQueue<ParsedRow> parsed;
+    SpscQueue<std::string> alarms_out;  // alarm messages from the parse stage to alarm_thread
+    StageMetrics fetch_metrics;
+    StageMetrics parse_metrics;
+    StageMetrics publish_metrics;
+    StageMetrics alarm_metrics;
+    StageMetrics end_to_end;
+
+    std::atomic<bool> stopping;
+    std::atomic<bool> alarm_active;     // shortens the poll interval to ALARM_POLL_INTERVAL
+    std::atomic<unsigned long> cycle_count;
+    // Deadline misses per phase; a phase cut short by the cycle budget also counts as a cycle miss
+    std::atomic<unsigned long> missed_discover;
+    std::atomic<unsigned long> missed_download;
+    std::atomic<unsigned long> missed_publish;
+    std::atomic<unsigned long> missed_cycle;
+    std::thread fetch_thread;
+    std::thread parse_thread;
+    std::thread publish_thread;
+    std::thread alarm_thread;       // publishes alarms so the parse stage never waits on the broker
+};
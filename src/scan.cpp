@@ -0,0 +1,431 @@
+#include "scan.h"
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Every kernel provides both entry points. They scan data[start, len) and report absolute
+// offsets, so a wide kernel can hand its tail to a narrower one.
+typedef size_t (*FirstFn)(const char* data, size_t start, size_t len, const ScanSet& set);
+typedef size_t (*AllFn)(const char* data, size_t start, size_t len, const ScanSet& set,
+                        uint32_t* out, size_t n, size_t max_out);
+
+inline bool in_set(unsigned char c, const ScanSet& set) {
+    return c == set.bytes[0] || c == set.bytes[1] || c == set.bytes[2] || c == set.bytes[3];
+}
+
+size_t first_scalar(const char* data, size_t start, size_t len, const ScanSet& set) {
+    for (size_t i = start; i < len; ++i) {
+        if (in_set(static_cast<unsigned char>(data[i]), set)) return i;
+    }
+    return len;
+}
+
+size_t all_scalar(const char* data, size_t start, size_t len, const ScanSet& set,
+                  uint32_t* out, size_t n, size_t max_out) {
+    for (size_t i = start; i < len && n < max_out; ++i) {
+        if (in_set(static_cast<unsigned char>(data[i]), set)) out[n++] = static_cast<uint32_t>(i);
+    }
+    return n;
+}
+
+// ============================================================================
+// SWAR: one machine word per step (4 bytes on the MIPS32 target, 8 on 64-bit hosts)
+// ============================================================================
+
+typedef size_t Word;
+
+const Word ONES = ~Word(0) / 0xFF;      // 0x01 in every byte
+const Word LOW7 = ONES * 0x7F;          // 0x7F in every byte
+const int WORD_BITS = static_cast<int>(sizeof(Word) * 8);
+
+// 0x80 in every byte of w that is zero, 0x00 elsewhere. Unlike the shorter
+// (w - ONES) & ~w & HIGHS trick this has no false positives, so it works on either endianness.
+inline Word zero_bytes(Word w) {
+    return ~(((w & LOW7) + LOW7) | w | LOW7);
+}
+
+inline int lowest_bit(Word w) {
+    return sizeof(Word) == 8 ? __builtin_ctzll(w) : __builtin_ctz(static_cast<unsigned>(w));
+}
+
+inline int highest_bit(Word w) {
+    return WORD_BITS - 1 - (sizeof(Word) == 8 ? __builtin_clzll(w) : __builtin_clz(static_cast<unsigned>(w)));
+}
+
+// Offset within the word of the first (lowest address) marked byte, and the marks without it
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+inline size_t first_marked_byte(Word marks) { return sizeof(Word) - 1 - highest_bit(marks) / 8; }
+inline Word clear_first_mark(Word marks) { return marks & ~(Word(1) << highest_bit(marks)); }
+#else
+inline size_t first_marked_byte(Word marks) { return lowest_bit(marks) / 8; }
+inline Word clear_first_mark(Word marks) { return marks & (marks - 1); }
+#endif
+
+template <int N>
+inline Word swar_marks(const char* p, const Word* pattern) {
+    Word w;
+    std::memcpy(&w, p, sizeof(Word));
+    Word marks = zero_bytes(w ^ pattern[0]);
+    if (N > 1) marks |= zero_bytes(w ^ pattern[1]);
+    if (N > 2) marks |= zero_bytes(w ^ pattern[2]);
+    if (N > 3) marks |= zero_bytes(w ^ pattern[3]);
+    return marks;
+}
+
+template <int N>
+size_t first_swar_n(const char* data, size_t start, size_t len, const ScanSet& set) {
+    Word pattern[4];
+    for (int k = 0; k < 4; ++k) pattern[k] = ONES * set.bytes[k];
+
+    size_t i = start;
+    for (; i + sizeof(Word) <= len; i += sizeof(Word)) {
+        Word marks = swar_marks<N>(data + i, pattern);
+        if (marks) return i + first_marked_byte(marks);
+    }
+    return first_scalar(data, i, len, set);
+}
+
+template <int N>
+size_t all_swar_n(const char* data, size_t start, size_t len, const ScanSet& set,
+                  uint32_t* out, size_t n, size_t max_out) {
+    Word pattern[4];
+    for (int k = 0; k < 4; ++k) pattern[k] = ONES * set.bytes[k];
+
+    size_t i = start;
+    for (; i + sizeof(Word) <= len; i += sizeof(Word)) {
+        for (Word marks = swar_marks<N>(data + i, pattern); marks; marks = clear_first_mark(marks)) {
+            if (n == max_out) return n;
+            out[n++] = static_cast<uint32_t>(i + first_marked_byte(marks));
+        }
+    }
+    return all_scalar(data, i, len, set, out, n, max_out);
+}
+
+size_t first_swar(const char* data, size_t start, size_t len, const ScanSet& set) {
+    switch (set.count) {
+    case 1: return first_swar_n<1>(data, start, len, set);
+    case 2: return first_swar_n<2>(data, start, len, set);
+    case 3: return first_swar_n<3>(data, start, len, set);
+    default: return first_swar_n<4>(data, start, len, set);
+    }
+}
+
+size_t all_swar(const char* data, size_t start, size_t len, const ScanSet& set,
+                uint32_t* out, size_t n, size_t max_out) {
+    switch (set.count) {
+    case 1: return all_swar_n<1>(data, start, len, set, out, n, max_out);
+    case 2: return all_swar_n<2>(data, start, len, set, out, n, max_out);
+    case 3: return all_swar_n<3>(data, start, len, set, out, n, max_out);
+    default: return all_swar_n<4>(data, start, len, set, out, n, max_out);
+    }
+}
+
+// ============================================================================
+// SSE2 / AVX2: 16 / 32 bytes per step; unused set entries repeat bytes[0], so all four
+// comparisons can always run
+// ============================================================================
+
+#ifdef SCAN_HAVE_X86
+
+__attribute__((target("sse2")))
+inline unsigned sse2_mask(const char* p, const __m128i* pattern) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, pattern[0]), _mm_cmpeq_epi8(v, pattern[1])),
+                             _mm_or_si128(_mm_cmpeq_epi8(v, pattern[2]), _mm_cmpeq_epi8(v, pattern[3])));
+    return static_cast<unsigned>(_mm_movemask_epi8(m));
+}
+
+__attribute__((target("sse2")))
+void sse2_patterns(const ScanSet& set, __m128i* pattern) {
+    for (int k = 0; k < 4; ++k) pattern[k] = _mm_set1_epi8(static_cast<char>(set.bytes[k]));
+}
+
+__attribute__((target("sse2")))
+size_t first_sse2(const char* data, size_t start, size_t len, const ScanSet& set) {
+    __m128i pattern[4];
+    sse2_patterns(set, pattern);
+    size_t i = start;
+    for (; i + 16 <= len; i += 16) {
+        unsigned mask = sse2_mask(data + i, pattern);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return first_scalar(data, i, len, set);
+}
+
+__attribute__((target("sse2")))
+size_t all_sse2(const char* data, size_t start, size_t len, const ScanSet& set,
+                uint32_t* out, size_t n, size_t max_out) {
+    __m128i pattern[4];
+    sse2_patterns(set, pattern);
+    size_t i = start;
+    for (; i + 16 <= len; i += 16) {
+        for (unsigned mask = sse2_mask(data + i, pattern); mask; mask &= mask - 1) {
+            if (n == max_out) return n;
+            out[n++] = static_cast<uint32_t>(i + __builtin_ctz(mask));
+        }
+    }
+    return all_scalar(data, i, len, set, out, n, max_out);
+}
+
+__attribute__((target("avx2")))
+inline unsigned avx2_mask(const char* p, const __m256i* pattern) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, pattern[0]), _mm256_cmpeq_epi8(v, pattern[1])),
+                                _mm256_or_si256(_mm256_cmpeq_epi8(v, pattern[2]), _mm256_cmpeq_epi8(v, pattern[3])));
+    return static_cast<unsigned>(_mm256_movemask_epi8(m));
+}
+
+__attribute__((target("avx2")))
+void avx2_patterns(const ScanSet& set, __m256i* pattern) {
+    for (int k = 0; k < 4; ++k) pattern[k] = _mm256_set1_epi8(static_cast<char>(set.bytes[k]));
+}
+
+__attribute__((target("avx2")))
+size_t first_avx2(const char* data, size_t start, size_t len, const ScanSet& set) {
+    __m256i pattern[4];
+    avx2_patterns(set, pattern);
+    size_t i = start;
+    for (; i + 32 <= len; i += 32) {
+        unsigned mask = avx2_mask(data + i, pattern);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    // Short rows and the tail still get 16 bytes per step
+    return first_sse2(data, i, len, set);
+}
+
+__attribute__((target("avx2")))
+size_t all_avx2(const char* data, size_t start, size_t len, const ScanSet& set,
+                uint32_t* out, size_t n, size_t max_out) {
+    __m256i pattern[4];
+    avx2_patterns(set, pattern);
+    size_t i = start;
+    for (; i + 32 <= len; i += 32) {
+        for (unsigned mask = avx2_mask(data + i, pattern); mask; mask &= mask - 1) {
+            if (n == max_out) return n;
+            out[n++] = static_cast<uint32_t>(i + __builtin_ctz(mask));
+        }
+    }
+    return all_sse2(data, i, len, set, out, n, max_out);
+}
+
+bool cpu_has_sse2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+bool cpu_has_avx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif // SCAN_HAVE_X86
+
+// ============================================================================
+// Dispatch
+// ============================================================================
+
+bool always() { return true; }
+
+struct Kernel {
+    const char* name;
+    FirstFn first;
+    AllFn all;
+    bool (*supported)();
+};
+
+// Ordered from slowest to fastest; the fastest supported one wins
+const Kernel KERNELS[] = {
+    { "scalar", first_scalar, all_scalar, always },
+    { "swar", first_swar, all_swar, always },
+#ifdef SCAN_HAVE_X86
+    { "sse2", first_sse2, all_sse2, cpu_has_sse2 },
+    { "avx2", first_avx2, all_avx2, cpu_has_avx2 },
+#endif
+};
+const size_t KERNEL_COUNT = sizeof(KERNELS) / sizeof(KERNELS[0]);
+
+const Kernel* choose_kernel() {
+    const char* forced = std::getenv("MM_SCAN_KERNEL");
+    const Kernel* best = &KERNELS[0];
+    for (size_t i = 0; i < KERNEL_COUNT; ++i) {
+        if (!KERNELS[i].supported()) continue;
+        if (forced && std::strcmp(forced, KERNELS[i].name) == 0) return &KERNELS[i];
+        best = &KERNELS[i];
+    }
+    if (forced) std::cerr << "MM_SCAN_KERNEL=" << forced << " is not available, using " << best->name << std::endl;
+    return best;
+}
+
+const Kernel& active_kernel() {
+    static const Kernel* kernel = choose_kernel();
+    return *kernel;
+}
+
+// Synthetic controller rows for the benchmark
+std::string make_rows(size_t bytes) {
+    std::string text;
+    text.reserve(bytes + 64);
+    std::minstd_rand rng(42);
+    char row[96];
+    for (unsigned n = 0; text.size() < bytes; ++n) {
+        int len = std::snprintf(row, sizeof(row), "2026-02-05 %02u:%02u:%02u,%u.%u,%u,%s\r\n",
+                                n / 3600 % 24, n / 60 % 60, n % 60, static_cast<unsigned>(rng() % 1000),
+                                static_cast<unsigned>(rng() % 10), 100 + static_cast<unsigned>(rng() % 7),
+                                rng() % 50 ? "OK" : "ALARM");
+        text.append(row, static_cast<size_t>(len));
+    }
+    return text;
+}
+
+// Split text the way for_each_row does (64 KiB blocks, bounded offset buffer); returns GB/s
+double measure(const Kernel& kernel, const std::string& text, const ScanSet& set, size_t& hits) {
+    const size_t block = 64 * 1024;
+    std::vector<uint32_t> offsets(4096);
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    size_t bytes = 0;
+    do {
+        hits = 0;
+        for (size_t base = 0; base < text.size(); base += block) {
+            size_t len = std::min(block, text.size() - base);
+            for (size_t pos = 0; pos < len; ) {
+                size_t n = kernel.all(text.data() + base, pos, len, set, offsets.data(), 0, offsets.size());
+                hits += n;
+                if (n < offsets.size()) break;
+                pos = offsets[n - 1] + 1;
+            }
+        }
+        bytes += text.size();
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    } while (elapsed < 0.25);
+    return bytes / elapsed / 1e9;
+}
+
+} // namespace
+
+ScanSet::ScanSet(const char* chars) : count(0) {
+    for (; chars[count] && count < 4; ++count) bytes[count] = static_cast<unsigned char>(chars[count]);
+    if (count == 0) bytes[count++] = 0;
+    for (int k = count; k < 4; ++k) bytes[k] = bytes[0];
+}
+
+size_t scan_for(const char* data, size_t len, const ScanSet& set) {
+    return active_kernel().first(data, 0, len, set);
+}
+
+size_t scan_all(const char* data, size_t len, const ScanSet& set, uint32_t* out, size_t max_out) {
+    return active_kernel().all(data, 0, len, set, out, 0, max_out);
+}
+
+size_t scan_for_scalar(const char* data, size_t len, const ScanSet& set) {
+    return first_scalar(data, 0, len, set);
+}
+
+size_t scan_all_scalar(const char* data, size_t len, const ScanSet& set, uint32_t* out, size_t max_out) {
+    return all_scalar(data, 0, len, set, out, 0, max_out);
+}
+
+const char* scan_kernel_name() {
+    return active_kernel().name;
+}
+
+bool scan_self_test(std::string& error_out) {
+    const char* sets[] = { "\n", "\r\n", ",;\t", ",;\t\n", "\x80\xff" };
+    // Mostly plain text, plus set members, NUL and high bytes that could upset the word tricks
+    const char alphabet[] = "0123456789.:- ,;\t\r\n\x80\xff\x7f\x01";
+    std::minstd_rand rng(7);
+    std::vector<char> buf(512 + 64);
+    std::vector<uint32_t> expect_all(512), got_all(512);
+
+    for (size_t k = 1; k < KERNEL_COUNT; ++k) {
+        const Kernel& kernel = KERNELS[k];
+        if (!kernel.supported()) continue;
+
+        for (size_t s = 0; s < sizeof(sets) / sizeof(sets[0]); ++s) {
+            ScanSet set(sets[s]);
+            for (size_t len = 0; len <= 300; ++len) {
+                for (size_t align = 0; align < 32; ++align) {
+                    char* data = buf.data() + align;
+                    for (int pass = 0; pass < 2; ++pass) {
+                        if (pass == 0) {
+                            // One match at a random position (or none)
+                            std::memset(buf.data(), 'x', buf.size());
+                            size_t target = rng() % (len + 1);
+                            if (target < len) data[target] = static_cast<char>(set.bytes[rng() % set.count]);
+                        } else {
+                            // Dense random text
+                            for (size_t i = 0; i < len; ++i) data[i] = alphabet[rng() % (sizeof(alphabet) - 1)];
+                        }
+                        // A match just past the end must never be reported
+                        data[len] = static_cast<char>(set.bytes[0]);
+
+                        size_t expect = first_scalar(data, 0, len, set);
+                        size_t got = kernel.first(data, 0, len, set);
+                        // A small max_out also exercises stopping and resuming mid-block
+                        size_t max_out = pass == 0 ? expect_all.size() : 1 + rng() % 8;
+                        size_t expect_n = 0, got_n = 0;
+                        for (size_t pos = 0; ; ) {
+                            size_t n = all_scalar(data, pos, len, set, expect_all.data(), expect_n, expect_n + max_out);
+                            if (n < expect_n + max_out) { expect_n = n; break; }
+                            expect_n = n;
+                            pos = expect_all[n - 1] + 1;
+                        }
+                        for (size_t pos = 0; ; ) {
+                            size_t n = kernel.all(data, pos, len, set, got_all.data(), got_n, got_n + max_out);
+                            if (n < got_n + max_out) { got_n = n; break; }
+                            got_n = n;
+                            pos = got_all[n - 1] + 1;
+                        }
+
+                        bool same = got == expect && got_n == expect_n &&
+                                    std::equal(expect_all.begin(), expect_all.begin() + expect_n, got_all.begin());
+                        if (!same) {
+                            std::ostringstream oss;
+                            oss << kernel.name << " kernel mismatch: set " << s << ", length " << len
+                                << ", alignment " << align << (pass == 0 ? ", single match" : ", random text")
+                                << ": first " << got << " (expected " << expect << "), all " << got_n
+                                << " matches (expected " << expect_n << ")";
+                            error_out = oss.str();
+                            return false;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void scan_benchmark(size_t megabytes) {
+    std::string text = make_rows(megabytes * 1024 * 1024);
+    ScanSet lines("\r\n");
+    ScanSet fields(",\r\n");
+
+    std::cout << "Splitting " << megabytes << " MB of rows, dispatch uses " << scan_kernel_name() << std::endl;
+    std::cout << std::left << std::setw(8) << "kernel" << std::right << std::setw(14) << "lines GB/s"
+              << std::setw(14) << "fields GB/s" << std::setw(12) << "line ends" << std::setw(12) << "boundaries"
+              << std::endl;
+    for (size_t k = 0; k < KERNEL_COUNT; ++k) {
+        if (!KERNELS[k].supported()) continue;
+        size_t line_hits = 0, field_hits = 0;
+        double line_rate = measure(KERNELS[k], text, lines, line_hits);
+        double field_rate = measure(KERNELS[k], text, fields, field_hits);
+        std::cout << std::left << std::setw(8) << KERNELS[k].name << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(14) << line_rate << std::setw(14) << field_rate
+                  << std::setw(12) << line_hits << std::setw(12) << field_hits << std::endl;
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+// Byte-set scanning kernel shared by the row parsers.
+//
+// scan_for() finds the first byte that belongs to a small set (line ends, field delimiters)
+// several bytes per step: SSE2 or AVX2 on x86, a word-at-a-time SWAR loop elsewhere (the MIPS
+// target). The implementation is chosen once at runtime from what the CPU supports; the
+// environment variable MM_SCAN_KERNEL=scalar|swar|sse2|avx2 forces one (for comparisons).
+
+// One to four distinct bytes to stop at, e.g. ScanSet("\r\n") or ScanSet(",;\t")
+struct ScanSet {
+    explicit ScanSet(const char* chars);
+
+    unsigned char bytes[4];     // unused entries repeat bytes[0]
+    int count;
+};
+
+// Offset of the first byte of data[0, len) that is in set, or len if there is none
+size_t scan_for(const char* data, size_t len, const ScanSet& set);
+
+// Bulk form for splitting whole blocks: writes the offset of every byte of data[0, len) that is
+// in set to out, in order, stopping after max_out. Returns the number written; if it equals
+// max_out, continue scanning after out[max_out - 1].
+size_t scan_all(const char* data, size_t len, const ScanSet& set, uint32_t* out, size_t max_out);
+
+// Byte-at-a-time reference implementations
+size_t scan_for_scalar(const char* data, size_t len, const ScanSet& set);
+size_t scan_all_scalar(const char* data, size_t len, const ScanSet& set, uint32_t* out, size_t max_out);
+
+// Name of the implementation scan_for() dispatches to
+const char* scan_kernel_name();
+
+// Compare every kernel this CPU supports against the scalar reference on generated buffers
+// (all short lengths and alignments, match positions across block boundaries).
+// Returns false and describes the first mismatch in error_out.
+bool scan_self_test(std::string& error_out);
+
+// Print the throughput (GB/s) of each supported kernel splitting `megabytes` of synthetic .dat
+// rows into lines and into fields with scan_all()
+void scan_benchmark(size_t megabytes);
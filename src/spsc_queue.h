@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Bounded single-producer/single-consumer ring buffer. try_push() may only be called from
+// one thread and try_pop() from one other thread; neither blocks nor takes a lock.
+// Indices are size_t so they stay lock-free on 32-bit targets (MIPS has no 64-bit atomics).
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) : slots(capacity + 1), head(0), tail(0) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Returns false (and leaves item untouched) when the queue is full
+    bool try_push(T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t next = increment(t);
+        if (next == head.load(std::memory_order_acquire)) return false;
+        slots[t] = std::move(item);
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Returns false when the queue is empty
+    bool try_pop(T& out) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        out = std::move(slots[h]);
+        slots[h] = T();
+        head.store(increment(h), std::memory_order_release);
+        return true;
+    }
+
+    // Approximate when called concurrently with push/pop
+    size_t size() const {
+        size_t h = head.load(std::memory_order_acquire);
+        size_t t = tail.load(std::memory_order_acquire);
+        return t >= h ? t - h : t + slots.size() - h;
+    }
+
+    size_t capacity() const { return slots.size() - 1; }
+
+private:
+    size_t increment(size_t i) const { return i + 1 == slots.size() ? 0 : i + 1; }
+
+    std::vector<T> slots;
+    // Producer and consumer indices on separate cache lines to avoid false sharing
+    std::atomic<size_t> head;
+    char pad[64];
+    std::atomic<size_t> tail;
+};
@@ -0,0 +1,297 @@
+#include "tls_session.h"
+#include <map>
+#include <memory>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+
+#ifdef ENABLE_TLS_SESSION_CACHE
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+#endif
+
+namespace {
+
+// ============================================================================
+// curl share handle: TLS sessions (and DNS) of every FTP transfer
+// ============================================================================
+
+std::mutex share_locks[CURL_LOCK_DATA_LAST];
+
+void share_lock(CURL*, curl_lock_data data, curl_lock_access, void*) {
+    share_locks[data].lock();
+}
+
+void share_unlock(CURL*, curl_lock_data data, void*) {
+    share_locks[data].unlock();
+}
+
+// Created on first use (after curl_global_init) and kept for the process lifetime
+CURLSH* ftp_share() {
+    static CURLSH* share = [] {
+        CURLSH* sh = curl_share_init();
+        if (sh) {
+            curl_share_setopt(sh, CURLSHOPT_LOCKFUNC, share_lock);
+            curl_share_setopt(sh, CURLSHOPT_UNLOCKFUNC, share_unlock);
+            curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+            curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        }
+        return sh;
+    }();
+    return share;
+}
+
+#ifdef ENABLE_TLS_SESSION_CACHE
+
+// ============================================================================
+// Handshake timing, from the OpenSSL info callback of either link
+// ============================================================================
+
+std::mutex handshake_mtx;
+std::map<const SSL*, std::chrono::steady_clock::time_point> handshake_start;
+
+void track_handshake(const SSL* ssl, int where, TlsStats& stats) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(handshake_mtx);
+    if (where & SSL_CB_HANDSHAKE_START) {
+        // A failed handshake never reports DONE; drop what earlier ones left behind
+        for (auto it = handshake_start.begin(); it != handshake_start.end();) {
+            if (now - it->second > std::chrono::minutes(1)) it = handshake_start.erase(it);
+            else ++it;
+        }
+        handshake_start[ssl] = now;
+    } else if (where & SSL_CB_HANDSHAKE_DONE) {
+        auto it = handshake_start.find(ssl);
+        if (it == handshake_start.end()) return;
+        long long us = std::chrono::duration_cast<std::chrono::microseconds>(now - it->second).count();
+        handshake_start.erase(it);
+        stats.record(us, SSL_session_reused(const_cast<SSL*>(ssl)) == 1);
+    }
+}
+
+// curl hands over its SSL_CTX only with the OpenSSL backend; other backends pass their own type
+bool curl_uses_openssl() {
+    static const bool openssl = [] {
+        const curl_version_info_data* info = curl_version_info(CURLVERSION_NOW);
+        return info && info->ssl_version && std::strncmp(info->ssl_version, "OpenSSL", 7) == 0;
+    }();
+    return openssl;
+}
+
+void ftp_info_callback(const SSL* ssl, int where, int) {
+    track_handshake(ssl, where, ftp_tls_stats());
+}
+
+CURLcode ftp_ssl_ctx_callback(CURL*, void* ssl_ctx, void*) {
+    SSL_CTX_set_info_callback(static_cast<SSL_CTX*>(ssl_ctx), ftp_info_callback);
+    return CURLE_OK;
+}
+
+// ============================================================================
+// MQTT client contexts
+// ============================================================================
+
+// mosquitto creates a fresh SSL for every connection and never offers an earlier session, so
+// the context keeps the broker's latest session and sets it on each new SSL as the handshake
+// starts, before the ClientHello is written
+struct MqttTlsContext {
+    SSL_CTX* ctx;
+    bool resume;
+    std::mutex mtx;
+    SSL_SESSION* last;
+
+    MqttTlsContext() : ctx(nullptr), resume(false), last(nullptr) {}
+};
+
+std::mutex contexts_mtx;
+std::map<std::string, std::unique_ptr<MqttTlsContext> > contexts;
+int context_index = -1;
+
+MqttTlsContext* context_of(const SSL* ssl) {
+    return static_cast<MqttTlsContext*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), context_index));
+}
+
+// New sessions (TLS 1.3 tickets arrive after the handshake, on mosquitto's loop thread)
+int mqtt_new_session(SSL* ssl, SSL_SESSION* session) {
+    MqttTlsContext* state = context_of(ssl);
+    if (!state || !state->resume) return 0;
+    std::lock_guard<std::mutex> lock(state->mtx);
+    if (state->last) SSL_SESSION_free(state->last);
+    state->last = session;
+    return 1;   // the reference is ours now
+}
+
+void mqtt_info_callback(const SSL* ssl, int where, int) {
+    if (where & SSL_CB_HANDSHAKE_START) {
+        MqttTlsContext* state = context_of(ssl);
+        if (state && state->resume && SSL_get_session(ssl) == nullptr) {
+            std::lock_guard<std::mutex> lock(state->mtx);
+            if (state->last) SSL_set_session(const_cast<SSL*>(ssl), state->last);
+        }
+    }
+    track_handshake(ssl, where, mqtt_tls_stats());
+}
+
+std::string openssl_error() {
+    unsigned long code = ERR_get_error();
+    char buf[256];
+    ERR_error_string_n(code, buf, sizeof(buf));
+    ERR_clear_error();
+    return code ? buf : "unknown error";
+}
+
+#endif // ENABLE_TLS_SESSION_CACHE
+
+} // namespace
+
+// ============================================================================
+// TlsStats
+// ============================================================================
+
+TlsStats::TlsStats(const std::string& link)
+    : link(link), full_count(0), resumed_count(0), full_us(0), resumed_us(0), last_us(0) {}
+
+void TlsStats::record(long long handshake_us, bool resumed) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (resumed) {
+        resumed_count++;
+        resumed_us += handshake_us;
+    } else {
+        full_count++;
+        full_us += handshake_us;
+    }
+    last_us = handshake_us;
+}
+
+void TlsStats::reset() {
+    std::lock_guard<std::mutex> lock(mtx);
+    full_count = resumed_count = 0;
+    full_us = resumed_us = last_us = 0;
+}
+
+unsigned long long TlsStats::handshakes() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return full_count + resumed_count;
+}
+
+unsigned long long TlsStats::resumed() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return resumed_count;
+}
+
+long long TlsStats::average_us(bool resumed) const {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (resumed) return resumed_count ? resumed_us / static_cast<long long>(resumed_count) : 0;
+    return full_count ? full_us / static_cast<long long>(full_count) : 0;
+}
+
+std::string TlsStats::summary() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(1);
+    oss << link << ": n=" << full_count + resumed_count << " resumed=" << resumed_count;
+    if (full_count) oss << " full avg=" << full_us / 1000.0 / full_count << "ms";
+    if (resumed_count) oss << " resumed avg=" << resumed_us / 1000.0 / resumed_count << "ms";
+    oss << " last=" << last_us / 1000.0 << "ms";
+    return oss.str();
+}
+
+TlsStats& ftp_tls_stats() {
+    static TlsStats stats("ftp");
+    return stats;
+}
+
+TlsStats& mqtt_tls_stats() {
+    static TlsStats stats("mqtt");
+    return stats;
+}
+
+std::string tls_stats_summary() {
+    std::string line;
+    if (ftp_tls_stats().handshakes()) line += ftp_tls_stats().summary();
+    if (mqtt_tls_stats().handshakes()) line += (line.empty() ? "" : " | ") + mqtt_tls_stats().summary();
+    return line.empty() ? line : "TLS handshakes - " + line;
+}
+
+// ============================================================================
+// Link options
+// ============================================================================
+
+void apply_ftp_link_options(CURL* curl, const Config& cfg) {
+    long use_ssl = cfg.ftp_tls == "require" ? static_cast<long>(CURLUSESSL_ALL)
+                 : cfg.ftp_tls == "off"     ? static_cast<long>(CURLUSESSL_NONE)
+                                            : static_cast<long>(CURLUSESSL_TRY);
+    curl_easy_setopt(curl, CURLOPT_USE_SSL, use_ssl);
+    if (!cfg.ftp_ca_file.empty()) curl_easy_setopt(curl, CURLOPT_CAINFO, cfg.ftp_ca_file.c_str());
+
+    // Without the share each transfer's fresh handle starts with an empty session cache
+    if (cfg.tls_session_cache && ftp_share()) curl_easy_setopt(curl, CURLOPT_SHARE, ftp_share());
+#ifdef ENABLE_TLS_SESSION_CACHE
+    if (use_ssl != CURLUSESSL_NONE && curl_uses_openssl()) {
+        curl_easy_setopt(curl, CURLOPT_SSL_CTX_FUNCTION, ftp_ssl_ctx_callback);
+    }
+#endif
+
+    curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, cfg.ftp_tcp_nodelay ? 1L : 0L);
+    if (cfg.ftp_tcp_keepalive > 0) {
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, static_cast<long>(cfg.ftp_tcp_keepalive));
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, static_cast<long>(cfg.ftp_tcp_keepalive));
+    }
+}
+
+bool mqtt_tls_enabled(const Config& cfg) {
+    return cfg.mqtt_tls || cfg.mqtt_server.rfind("ssl://", 0) == 0 || cfg.mqtt_server.rfind("mqtts://", 0) == 0;
+}
+
+#ifdef ENABLE_TLS_SESSION_CACHE
+SSL_CTX* mqtt_tls_context(const Config& cfg, const std::string& host, std::string& error_out) {
+    const std::string key = host + '\n' + cfg.mqtt_ca_file + '\n' + cfg.mqtt_cert_file + '\n' +
+                            cfg.mqtt_key_file + '\n' + (cfg.tls_session_cache ? "resume" : "");
+    std::lock_guard<std::mutex> lock(contexts_mtx);
+    auto found = contexts.find(key);
+    if (found != contexts.end()) return found->second->ctx;
+
+    if (context_index < 0) context_index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+    if (!ctx) {
+        error_out = "SSL_CTX_new failed: " + openssl_error();
+        return nullptr;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+    bool ok = cfg.mqtt_ca_file.empty() ? SSL_CTX_set_default_verify_paths(ctx) == 1
+                                       : SSL_CTX_load_verify_locations(ctx, cfg.mqtt_ca_file.c_str(), nullptr) == 1;
+    if (!ok) {
+        error_out = "cannot load CA " + (cfg.mqtt_ca_file.empty() ? "store" : cfg.mqtt_ca_file) + ": " + openssl_error();
+    } else if (!cfg.mqtt_cert_file.empty()) {
+        const std::string& key_file = cfg.mqtt_key_file.empty() ? cfg.mqtt_cert_file : cfg.mqtt_key_file;
+        ok = SSL_CTX_use_certificate_chain_file(ctx, cfg.mqtt_cert_file.c_str()) == 1 &&
+             SSL_CTX_use_PrivateKey_file(ctx, key_file.c_str(), SSL_FILETYPE_PEM) == 1;
+        if (!ok) error_out = "cannot load client certificate " + cfg.mqtt_cert_file + ": " + openssl_error();
+    }
+    if (!ok) {
+        SSL_CTX_free(ctx);
+        return nullptr;
+    }
+
+    // Verify the chain and that it was issued for the broker (an IP address or a host name)
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+    X509_VERIFY_PARAM* param = SSL_CTX_get0_param(ctx);
+    if (X509_VERIFY_PARAM_set1_ip_asc(param, host.c_str()) != 1) {
+        X509_VERIFY_PARAM_set1_host(param, host.c_str(), 0);
+    }
+
+    std::unique_ptr<MqttTlsContext> state(new MqttTlsContext());
+    state->ctx = ctx;
+    state->resume = cfg.tls_session_cache;
+    SSL_CTX_set_ex_data(ctx, context_index, state.get());
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, mqtt_new_session);
+    SSL_CTX_set_info_callback(ctx, mqtt_info_callback);
+    contexts[key] = std::move(state);
+    return ctx;
+}
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <curl/curl.h>
+#include "config.h"
+
+// TLS for the FTPS and MQTTS links: session resumption and handshake metrics.
+//
+// A full handshake (certificate chain, key exchange) costs the MIPS CPU far more than an
+// abbreviated one that resumes an earlier session. With TLS_SESSION_CACHE on, every FTP transfer
+// (live, backfill workers) shares one curl session cache, and every MQTT connection to the
+// broker (live, alarm, backfill, reconnects) shares one SSL_CTX that offers the broker's last
+// session ticket. Resumption and handshake timing need OpenSSL and are compiled in with
+// ENABLE_TLS_SESSION_CACHE; without it FTP still shares curl's session cache.
+
+// Handshake counters for one link; one handshake per TLS connection (FTPS control and data
+// connections count separately)
+class TlsStats {
+public:
+    explicit TlsStats(const std::string& link);
+
+    void record(long long handshake_us, bool resumed);
+    void reset();
+    // e.g. "ftp: n=8 resumed=7 full avg=48.1ms resumed avg=6.2ms last=5.9ms"
+    std::string summary() const;
+
+    unsigned long long handshakes() const;
+    unsigned long long resumed() const;
+    // Average handshake time of the full or resumed handshakes, microseconds
+    long long average_us(bool resumed) const;
+
+private:
+    const std::string link;
+    mutable std::mutex mtx;
+    unsigned long long full_count;
+    unsigned long long resumed_count;
+    long long full_us;
+    long long resumed_us;
+    long long last_us;
+};
+
+TlsStats& ftp_tls_stats();
+TlsStats& mqtt_tls_stats();
+
+// "TLS handshakes - ..." line for the metrics log; empty when no TLS connection was made
+std::string tls_stats_summary();
+
+// Set the TLS, session cache, keepalive and Nagle options of one FTP transfer
+// (FTP_TLS, FTP_CA_FILE, TLS_SESSION_CACHE, FTP_TCP_KEEPALIVE, FTP_TCP_NODELAY)
+void apply_ftp_link_options(CURL* curl, const Config& cfg);
+
+// True if the MQTT link uses TLS (MQTT_TLS, or an ssl:// / mqtts:// MQTT_SERVER)
+bool mqtt_tls_enabled(const Config& cfg);
+
+#ifdef ENABLE_TLS_SESSION_CACHE
+typedef struct ssl_ctx_st SSL_CTX;
+
+// Client context for the MQTT broker at host: verifies the broker against MQTT_CA_FILE (or the
+// system store) and the host name, presents MQTT_CERT_FILE/MQTT_KEY_FILE if set, and with
+// TLS_SESSION_CACHE resumes the last session on every new connection. One context per set of
+// settings, kept for the process lifetime since mosquitto instances hold on to it.
+// Returns nullptr and sets error_out if the files cannot be loaded.
+SSL_CTX* mqtt_tls_context(const Config& cfg, const std::string& host, std::string& error_out);
+#endif
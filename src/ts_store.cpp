@@ -0,0 +1,568 @@
+#include "ts_store.h"
+#include "parser.h"
+#include "scan.h"
+#include "utils.h"
+#include <algorithm>
+#include <memory>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char SEGMENT_MAGIC[8] = {'M', 'M', 'T', 'S', 'S', 'E', 'G', '1'};
+const uint32_t SEGMENT_ROWS = 4096;
+const uint32_t SPARSE_SLOTS = 64;
+const uint32_t SPARSE_STRIDE = SEGMENT_ROWS / SPARSE_SLOTS;
+const size_t DATA_OFFSET = 4096;    // columns start on their own page
+const uint32_t SEGMENT_BACKFILL = 1;    // segment of the backfill chain
+
+struct SegmentHeader {
+    char magic[8];
+    uint32_t capacity;
+    uint32_t fields;
+    uint32_t count;             // published with a release store once a row is fully written
+    uint32_t flags;             // SEGMENT_BACKFILL
+    int64_t first_ts;
+    int64_t last_ts;
+    int64_t sparse[SPARSE_SLOTS];   // timestamp of row k * SPARSE_STRIDE
+};
+
+size_t segment_bytes(uint32_t fields) {
+    return DATA_OFFSET + SEGMENT_ROWS * sizeof(int64_t) + static_cast<size_t>(fields) * SEGMENT_ROWS * sizeof(float);
+}
+
+struct SegmentFile {
+    unsigned long seq;
+    std::string path;
+};
+
+// Segments named seg_<seq>.mmts, sorted oldest first
+std::vector<SegmentFile> list_segments(const std::string& dir) {
+    std::vector<SegmentFile> segments;
+    DIR* d = opendir(dir.c_str());
+    if (!d) return segments;
+    while (struct dirent* entry = readdir(d)) {
+        unsigned long seq = 0;
+        char tail[8] = {0};
+        if (std::sscanf(entry->d_name, "seg_%lu.%7s", &seq, tail) == 2 && std::strcmp(tail, "mmts") == 0) {
+            SegmentFile f;
+            f.seq = seq;
+            f.path = dir + "/" + entry->d_name;
+            segments.push_back(f);
+        }
+    }
+    closedir(d);
+    std::sort(segments.begin(), segments.end(),
+              [](const SegmentFile& a, const SegmentFile& b) { return a.seq < b.seq; });
+    return segments;
+}
+
+// Space a file actually takes: segments are sparse, so a partly filled one takes far less than
+// its apparent size
+long long allocated_bytes(const struct stat& st) {
+    return static_cast<long long>(st.st_blocks) * 512;
+}
+
+// Read a segment header without mapping the file. Returns false if it is not a valid segment;
+// bytes is set either way, so retention can still count and drop a damaged file.
+bool read_header(const std::string& path, SegmentHeader& h, long long& bytes) {
+    bytes = 0;
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    if (ok) bytes = allocated_bytes(st);
+    ok = ok && pread(fd, &h, sizeof(h), 0) == static_cast<ssize_t>(sizeof(h)) &&
+         std::memcmp(h.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) == 0 && h.capacity == SEGMENT_ROWS &&
+         static_cast<size_t>(st.st_size) >= segment_bytes(h.fields) && h.count <= SEGMENT_ROWS;
+    ::close(fd);
+    return ok;
+}
+
+// days_from_civil / civil_from_days: proleptic Gregorian calendar <-> days since 1970-01-01
+long long days_from_civil(long long y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    const long long era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = static_cast<unsigned>(y - era * 400);
+    const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<long long>(doe) - 719468;
+}
+
+void civil_from_days(long long z, int& y, unsigned& m, unsigned& d) {
+    z += 719468;
+    const long long era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = static_cast<unsigned>(z - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = static_cast<int>(yoe + era * 400 + (m <= 2));
+}
+
+// mkdir -p
+bool make_dirs(const std::string& path) {
+    for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1)) {
+        std::string part = path.substr(0, pos);
+        if (mkdir(part.c_str(), 0755) != 0 && errno != EEXIST) return false;
+        if (pos == std::string::npos) return true;
+    }
+}
+
+bool looks_like_time(const std::string& s) {
+    int hh, mm;
+    return s.find(':') != std::string::npos && std::sscanf(s.c_str(), " %d:%d", &hh, &mm) == 2;
+}
+
+} // namespace
+
+// ============================================================================
+// Timestamp and row decoding
+// ============================================================================
+
+bool parse_timestamp(const std::string& text, long long& ts) {
+    return parse_timestamp(text.c_str(), ts);
+}
+
+bool parse_timestamp(const char* text, long long& ts) {
+    int a = 0, b = 0, c = 0, consumed = 0;
+    char s1 = 0, s2 = 0;
+    if (std::sscanf(text, " %d%c%d%c%d%n", &a, &s1, &b, &s2, &c, &consumed) < 5) return false;
+    if (s1 != s2 || (s1 != '-' && s1 != '/' && s1 != '.')) return false;
+
+    int year, month, day;
+    if (a > 31) { year = a; month = b; day = c; }            // YYYY-MM-DD
+    else { day = a; month = b; year = c < 100 ? 2000 + c : c; } // DD/MM/YYYY, DD.MM.YY
+    if (month < 1 || month > 12 || day < 1 || day > 31 || year < 1970) return false;
+
+    int hh = 0, mi = 0, ss = 0;
+    const char* rest = text + consumed;
+    if (*rest == ' ' || *rest == 'T') {
+        int n = std::sscanf(rest + 1, "%d:%d:%d", &hh, &mi, &ss);
+        if (n < 2) { hh = mi = ss = 0; }
+        if (hh < 0 || hh > 23 || mi < 0 || mi > 59 || ss < 0 || ss > 60) return false;
+    }
+
+    ts = days_from_civil(year, static_cast<unsigned>(month), static_cast<unsigned>(day)) * 86400LL +
+         hh * 3600 + mi * 60 + ss;
+    return true;
+}
+
+std::string format_timestamp(long long ts) {
+    long long days = ts >= 0 ? ts / 86400 : (ts - 86399) / 86400;
+    long long secs = ts - days * 86400;
+    int y;
+    unsigned m, d;
+    civil_from_days(days, y, m, d);
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%04d-%02u-%02u %02d:%02d:%02d", y, m, d,
+                  static_cast<int>(secs / 3600), static_cast<int>(secs / 60 % 60), static_cast<int>(secs % 60));
+    return buf;
+}
+
+bool decode_row(const std::string& row, long long& ts, float* values, int max_fields) {
+    // The first of , ; or tab decides the delimiter for the whole row
+    static const ScanSet delimiters(",;\t");
+    size_t delim_pos = scan_for(row.data(), row.size(), delimiters);
+    char delim[2] = { delim_pos < row.size() ? row[delim_pos] : '\0', '\0' };
+
+    std::vector<std::string> parts;
+    if (delim[0]) {
+        ScanSet field_end(delim);
+        size_t start = 0;
+        while (true) {
+            size_t end = start + scan_for(row.data() + start, row.size() - start, field_end);
+            parts.push_back(row.substr(start, end - start));
+            if (end == row.size()) break;
+            start = end + 1;
+        }
+    } else {
+        parts.push_back(row);
+    }
+
+    size_t first_value = 1;
+    if (parts[0].find(':') == std::string::npos && parts.size() > 1 && looks_like_time(parts[1])) {
+        // Date and time in separate columns
+        if (!parse_timestamp(parts[0] + " " + parts[1], ts)) return false;
+        first_value = 2;
+    } else if (!parse_timestamp(parts[0], ts)) {
+        return false;
+    }
+
+    for (int i = 0; i < max_fields; ++i) {
+        size_t idx = first_value + static_cast<size_t>(i);
+        values[i] = NAN;
+        if (idx >= parts.size()) continue;
+        const char* text = parts[idx].c_str();
+        char* end = nullptr;
+        double v = std::strtod(text, &end);
+        while (end && (*end == ' ' || *end == '\r')) ++end;
+        if (end != text && end && *end == '\0') values[i] = static_cast<float>(v);
+    }
+    return true;
+}
+
+// ============================================================================
+// Segments
+// ============================================================================
+
+struct TimeSeriesStore::Segment {
+    std::string path;
+    int fd;
+    uint8_t* base;
+    size_t size;
+
+    Segment() : fd(-1), base(nullptr), size(0) {}
+    ~Segment() {
+        if (base) munmap(base, size);
+        if (fd >= 0) ::close(fd);
+    }
+
+    // Map an existing segment; writable maps are used by the appender only
+    bool map(const std::string& p, bool writable) {
+        path = p;
+        fd = ::open(p.c_str(), writable ? O_RDWR : O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SegmentHeader)) return false;
+        size = static_cast<size_t>(st.st_size);
+        void* m = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        if (m == MAP_FAILED) return false;
+        base = static_cast<uint8_t*>(m);
+        const SegmentHeader* h = header();
+        return std::memcmp(h->magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) == 0 &&
+               h->capacity == SEGMENT_ROWS && size >= segment_bytes(h->fields);
+    }
+
+    SegmentHeader* header() const { return reinterpret_cast<SegmentHeader*>(base); }
+    int64_t* timestamps() const { return reinterpret_cast<int64_t*>(base + DATA_OFFSET); }
+    float* column(uint32_t field) const {
+        return reinterpret_cast<float*>(base + DATA_OFFSET + SEGMENT_ROWS * sizeof(int64_t)) + field * SEGMENT_ROWS;
+    }
+    uint32_t count() const { return __atomic_load_n(&header()->count, __ATOMIC_ACQUIRE); }
+
+    // True if a row has timestamp ts (timestamps are sorted within a segment)
+    bool holds(long long ts) const {
+        uint32_t n = count();
+        if (n == 0 || ts < header()->first_ts || ts > header()->last_ts) return false;
+        return std::binary_search(timestamps(), timestamps() + n, static_cast<int64_t>(ts));
+    }
+};
+
+TimeSeriesStore::TimeSeriesStore()
+    : fields(0), max_bytes(0), max_age_seconds(0), current(nullptr), backfill_current(nullptr), lookup(nullptr),
+      next_seq(1), newest_ts(0) {}
+
+TimeSeriesStore::~TimeSeriesStore() {
+    close_segments();
+}
+
+void TimeSeriesStore::close_segments() {
+    delete current;
+    current = nullptr;
+    delete backfill_current;
+    backfill_current = nullptr;
+    delete lookup;
+    lookup = nullptr;
+    segments.clear();
+}
+
+bool TimeSeriesStore::open(const Config& cfg) {
+    std::lock_guard<std::mutex> lock(mtx);
+    close_segments();
+
+    dir = cfg.ts_store_dir;
+    log_file = cfg.log_file;
+    fields = cfg.ts_store_fields;
+    max_bytes = static_cast<long long>(cfg.ts_store_max_mb) * 1024 * 1024;
+    max_age_seconds = static_cast<long long>(cfg.ts_store_max_age_days) * 86400;
+    if (dir.empty()) return false;
+
+    if (!make_dirs(dir)) {
+        write_log(log_file, "TS store: Cannot create " + dir + ": " + std::strerror(errno));
+        dir.clear();
+        return false;
+    }
+
+    std::vector<SegmentFile> files = list_segments(dir);
+    newest_ts = 0;
+    std::string last_live, last_backfill;
+    for (const auto& f : files) {
+        SegmentHeader h;
+        SegmentInfo info;
+        info.path = f.path;
+        info.first_ts = info.last_ts = 0;
+        info.count = 0;
+        if (read_header(f.path, h, info.bytes)) {
+            info.first_ts = h.first_ts;
+            info.last_ts = h.last_ts;
+            info.count = h.count;
+            if (h.count > 0) newest_ts = std::max<long long>(newest_ts, h.last_ts);
+            (h.flags & SEGMENT_BACKFILL ? last_backfill : last_live) = f.path;
+        }
+        segments.push_back(info);
+        next_seq = std::max(next_seq, f.seq + 1);
+    }
+
+    // Keep appending to the newest segment of each chain if it has room and the same layout
+    Segment** chains[] = { &current, &backfill_current };
+    const std::string* last[] = { &last_live, &last_backfill };
+    for (int c = 0; c < 2; ++c) {
+        if (last[c]->empty()) continue;
+        Segment* seg = new Segment();
+        if (seg->map(*last[c], true) && seg->header()->fields == static_cast<uint32_t>(fields) &&
+            seg->count() < SEGMENT_ROWS) {
+            *chains[c] = seg;
+        } else {
+            delete seg;
+        }
+    }
+
+    enforce_retention();
+    write_log(log_file, "TS store: Opened " + dir + " (" + std::to_string(files.size()) + " segments, newest " +
+              (newest_ts ? format_timestamp(newest_ts) : std::string("none")) + ")");
+    return true;
+}
+
+bool TimeSeriesStore::start_segment(bool backfill) {
+    Segment*& chain = backfill ? backfill_current : current;
+    if (chain) sync_info(chain);    // final size and range of the segment being closed
+    delete chain;
+    chain = nullptr;
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "seg_%08lu.mmts", next_seq++);
+    std::string path = dir + "/" + name;
+    size_t bytes = segment_bytes(static_cast<uint32_t>(fields));
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        write_log(log_file, "TS store: Cannot create segment " + path + ": " + std::strerror(errno));
+        return false;
+    }
+    // Sparse file: untouched column pages take no space on flash
+    SegmentHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+    h.capacity = SEGMENT_ROWS;
+    h.fields = static_cast<uint32_t>(fields);
+    h.flags = backfill ? SEGMENT_BACKFILL : 0;
+    bool ok = ftruncate(fd, static_cast<off_t>(bytes)) == 0 && pwrite(fd, &h, sizeof(h), 0) == sizeof(h);
+    ::close(fd);
+    if (!ok) {
+        write_log(log_file, "TS store: Cannot initialise segment " + path);
+        std::remove(path.c_str());
+        return false;
+    }
+
+    Segment* seg = new Segment();
+    if (!seg->map(path, true)) {
+        delete seg;
+        return false;
+    }
+    chain = seg;
+    SegmentInfo info;
+    info.path = path;
+    info.bytes = 0;
+    info.first_ts = info.last_ts = 0;
+    info.count = 0;
+    segments.push_back(info);
+    enforce_retention();
+    return true;
+}
+
+// Refresh the in-memory entry of a segment being written: its size and range change with every row
+void TimeSeriesStore::sync_info(const Segment* seg) {
+    for (auto it = segments.rbegin(); it != segments.rend(); ++it) {
+        if (it->path != seg->path) continue;
+        struct stat st;
+        if (fstat(seg->fd, &st) == 0) it->bytes = allocated_bytes(st);
+        it->count = seg->count();
+        it->first_ts = seg->header()->first_ts;
+        it->last_ts = seg->header()->last_ts;
+        return;
+    }
+}
+
+// True if a row with timestamp ts is already stored in either chain
+bool TimeSeriesStore::stored(long long ts) {
+    if ((current && current->holds(ts)) || (backfill_current && backfill_current->holds(ts))) return true;
+    for (const auto& info : segments) {
+        if (info.count == 0 || ts < info.first_ts || ts > info.last_ts) continue;
+        if ((current && info.path == current->path) || (backfill_current && info.path == backfill_current->path)) continue;
+        // Backfilled rows arrive in order, so consecutive lookups usually hit the same segment
+        if (!lookup || lookup->path != info.path) {
+            delete lookup;
+            lookup = new Segment();
+            if (!lookup->map(info.path, false)) {
+                delete lookup;
+                lookup = nullptr;
+                continue;
+            }
+        }
+        if (lookup->holds(ts)) return true;
+    }
+    return false;
+}
+
+void TimeSeriesStore::enforce_retention() {
+    if (current) sync_info(current);
+    if (backfill_current) sync_info(backfill_current);
+    long long total = 0;
+    for (const auto& info : segments) total += info.bytes;
+
+    for (auto it = segments.begin(); it != segments.end();) {
+        // Never drop a segment being written
+        if ((current && it->path == current->path) || (backfill_current && it->path == backfill_current->path)) {
+            ++it;
+            continue;
+        }
+        bool too_big = max_bytes > 0 && total > max_bytes;
+        bool too_old = max_age_seconds > 0 && newest_ts > 0 && it->count > 0 &&
+                       newest_ts - it->last_ts > max_age_seconds;
+        if ((!too_big && !too_old) || (std::remove(it->path.c_str()) != 0 && errno != ENOENT)) {
+            ++it;
+            continue;
+        }
+        write_log(log_file, "TS store: Retention removed " + it->path);
+        if (lookup && lookup->path == it->path) {
+            delete lookup;
+            lookup = nullptr;
+        }
+        total -= it->bytes;
+        it = segments.erase(it);
+    }
+}
+
+bool TimeSeriesStore::append(long long ts, const float* values, bool backfill) {
+    if (dir.empty()) return false;
+
+    Segment*& chain = backfill ? backfill_current : current;
+    bool need_new = !chain;
+    if (chain) {
+        uint32_t n = chain->count();
+        need_new = n >= SEGMENT_ROWS || (n > 0 && ts < chain->header()->last_ts);
+    }
+    if (need_new && !start_segment(backfill)) return false;
+
+    SegmentHeader* h = chain->header();
+    uint32_t n = h->count;
+    chain->timestamps()[n] = ts;
+    for (int i = 0; i < fields; ++i) chain->column(static_cast<uint32_t>(i))[n] = values[i];
+    if (n % SPARSE_STRIDE == 0) h->sparse[n / SPARSE_STRIDE] = ts;
+    if (n == 0) h->first_ts = ts;
+    h->last_ts = ts;
+    __atomic_store_n(&h->count, n + 1, __ATOMIC_RELEASE);
+
+    newest_ts = std::max(newest_ts, ts);
+    return true;
+}
+
+bool TimeSeriesStore::append_row(const std::string& row, bool backfill) {
+    std::vector<float> values(static_cast<size_t>(std::max(fields, 1)));
+    long long ts = 0;
+    if (!decode_row(row, ts, values.data(), fields)) return false;
+    std::lock_guard<std::mutex> lock(mtx);
+    // The gap a backfill fills may overlap rows the live chain or an earlier backfill stored
+    if (backfill && !dir.empty() && stored(ts)) return true;
+    return append(ts, values.data(), backfill);
+}
+
+long TimeSeriesStore::ingest_file(const std::string& local_file) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (dir.empty()) return 0;
+
+    std::vector<float> values(static_cast<size_t>(std::max(fields, 1)));
+    long appended = 0;
+    for_each_row(local_file, [&](const std::string& row) {
+        long long ts = 0;
+        // Rows without a timestamp cannot be de-duplicated across polls, so they are not stored
+        if (decode_row(row, ts, values.data(), fields) && ts > newest_ts && append(ts, values.data(), false)) appended++;
+        return true;
+    });
+    return appended;
+}
+
+bool TimeSeriesStore::query(const std::string& dir, long long from, long long to, const RowVisitor& visit,
+                            std::string& error_out) {
+    if (dir.empty()) {
+        error_out = "TS_STORE_DIR is not configured";
+        return false;
+    }
+    std::vector<SegmentFile> files = list_segments(dir);
+    if (files.empty()) {
+        error_out = "No segments in " + dir;
+        return false;
+    }
+
+    // Segments that overlap the window, by first timestamp. The chains interleave in time and a
+    // chain restarts on an older row, so segments can overlap: their rows are merged below.
+    struct Pending {
+        std::string path;
+        long long first_ts;
+    };
+    std::vector<Pending> pending;
+    for (const auto& f : files) {
+        SegmentHeader h;
+        long long bytes;
+        if (!read_header(f.path, h, bytes) || h.count == 0 || h.first_ts > to || h.last_ts < from) continue;
+        Pending p;
+        p.path = f.path;
+        p.first_ts = h.first_ts;
+        pending.push_back(p);
+    }
+    std::stable_sort(pending.begin(), pending.end(),
+                     [](const Pending& a, const Pending& b) { return a.first_ts < b.first_ts; });
+
+    // A segment is mapped once the merge reaches its first timestamp and unmapped when it runs
+    // out of rows in the window, so only overlapping segments are mapped together
+    struct Cursor {
+        std::unique_ptr<Segment> seg;
+        uint32_t i;
+        uint32_t n;
+        long long ts() const { return seg->timestamps()[i]; }
+    };
+    std::vector<Cursor> active;
+    std::vector<float> row_values;
+    size_t next = 0;
+    while (true) {
+        size_t best = active.size();
+        for (size_t a = 0; a < active.size(); ++a) {
+            if (best == active.size() || active[a].ts() < active[best].ts()) best = a;
+        }
+        if (next < pending.size() && (best == active.size() || pending[next].first_ts <= active[best].ts())) {
+            Cursor c;
+            c.seg.reset(new Segment());
+            if (!c.seg->map(pending[next++].path, false)) continue;
+            const SegmentHeader* h = c.seg->header();
+            c.n = c.seg->count();
+
+            // Sparse index: jump to the stride that may contain `from`, then scan at most one stride
+            uint32_t slots = (c.n + SPARSE_STRIDE - 1) / SPARSE_STRIDE;
+            uint32_t k = 0;
+            while (k < slots && h->sparse[k] < from) ++k;
+            c.i = k == 0 ? 0 : (k - 1) * SPARSE_STRIDE;
+            while (c.i < c.n && c.ts() < from) ++c.i;
+            if (c.i < c.n && c.ts() <= to) active.push_back(std::move(c));
+            continue;
+        }
+        if (best == active.size()) break;
+
+        Cursor& c = active[best];
+        uint32_t fields = c.seg->header()->fields;
+        row_values.resize(std::max<uint32_t>(fields, 1));
+        for (uint32_t f = 0; f < fields; ++f) row_values[f] = c.seg->column(f)[c.i];
+        visit(c.ts(), row_values.data(), static_cast<int>(fields));
+        if (++c.i >= c.n || c.ts() > to) active.erase(active.begin() + static_cast<long>(best));
+    }
+    return true;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+#include "config.h"
+
+// Append-only columnar time-series store for on-site history.
+//
+// Decoded rows are appended to fixed-capacity segment files in TS_STORE_DIR. Each segment has
+// a small header (row count, first/last timestamp and a sparse index holding the timestamp of
+// every 64th row) followed by fixed-width columns: int64 timestamps, then one float32 column
+// per field. Timestamps within a segment are non-decreasing. Live and backfilled rows go to
+// separate segment chains, so interleaving the two never cuts segments short; only a row older
+// than its own chain's last one starts a new segment. A backfilled row whose timestamp is
+// already stored is skipped. Segments are written and read through mmap, so a query process can
+// scan them while the daemon appends. Retention drops the oldest segments by space used on disk
+// and by age, from a list of segment sizes and time ranges kept in memory.
+class TimeSeriesStore {
+public:
+    TimeSeriesStore();
+    ~TimeSeriesStore();
+
+    // Open (or create) the store for appending. Returns false if TS_STORE_DIR is unusable.
+    bool open(const Config& cfg);
+    bool is_open() const { return !dir.empty(); }
+
+    // Decode and append one data row to the live or the backfill chain; false if the row has
+    // no parsable timestamp. A backfilled row with a timestamp already stored is skipped.
+    bool append_row(const std::string& row, bool backfill);
+
+    // Append the rows of a local .dat file that are newer than the newest stored timestamp.
+    // Returns the number of rows appended.
+    long ingest_file(const std::string& local_file);
+
+    // Visit stored rows with from <= ts <= to in timestamp order, merging the live and backfill
+    // chains. values points to `fields` floats (NaN for missing or non-numeric fields).
+    typedef std::function<void(long long ts, const float* values, int fields)> RowVisitor;
+    static bool query(const std::string& dir, long long from, long long to, const RowVisitor& visit,
+                      std::string& error_out);
+
+private:
+    struct Segment;
+
+    // What retention and de-duplication need to know about a segment file
+    struct SegmentInfo {
+        std::string path;
+        long long bytes;        // allocated on disk
+        long long first_ts;
+        long long last_ts;
+        uint32_t count;
+    };
+
+    bool append(long long ts, const float* values, bool backfill);
+    bool start_segment(bool backfill);
+    void sync_info(const Segment* seg);
+    bool stored(long long ts);
+    void enforce_retention();
+    void close_segments();
+
+    std::string dir;
+    std::string log_file;
+    int fields;
+    long long max_bytes;
+    long long max_age_seconds;
+
+    std::mutex mtx;
+    Segment* current;               // live chain
+    Segment* backfill_current;      // backfill chain
+    Segment* lookup;                // older segment mapped read-only for de-duplication
+    std::vector<SegmentInfo> segments;  // oldest first
+    unsigned long next_seq;
+    long long newest_ts;
+};
+
+// Parse "YYYY-MM-DD[ T]HH:MM[:SS]", "DD/MM/YYYY HH:MM[:SS]", "DD.MM.YYYY ..." or a date alone.
+// The result is the controller's wall-clock time expressed as seconds since the epoch (no time
+// zone conversion), so it does not depend on the gateway's own clock or TZ setting.
+bool parse_timestamp(const std::string& text, long long& ts);
+// Same, reading in place: parsing stops at the first character that cannot be part of the timestamp
+bool parse_timestamp(const char* text, long long& ts);
+
+// Inverse of parse_timestamp: "YYYY-MM-DD HH:MM:SS"
+std::string format_timestamp(long long ts);
+
+// Split a data row into its timestamp and up to max_fields numeric values (NaN if not numeric).
+// A date and a time in the first two fields are combined. Returns false without a timestamp.
+bool decode_row(const std::string& row, long long& ts, float* values, int max_fields);
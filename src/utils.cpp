@@ -3,7 +3,16 @@
 #include <sstream>
 #include <iomanip>
 #include <fstream>
+#include <chrono>
 
+namespace {
+// Initialised before main() runs, so it approximates the process start time
+const std::chrono::steady_clock::time_point process_start = std::chrono::steady_clock::now();
+}
+
+long long ms_since_start() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - process_start).count();
+}
 
 void write_log(const std::string& log_file, const std::string& message) {
     if (log_file.empty()) return;
@@ -4,3 +4,6 @@
 
 // Appends message with timestamp to a log file
 void write_log(const std::string& log_file, const std::string& message);
+
+// Milliseconds since the process started (monotonic), for startup metrics
+long long ms_since_start();